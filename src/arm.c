@@ -63,8 +63,8 @@ void pushcli (void)
 
     cli();
 
-    if (cpu->ncli++ == 0) {
-        cpu->intena = enabled;
+    if (mycpu()->ncli++ == 0) {
+        mycpu()->intena = enabled;
     }
 }
 
@@ -74,12 +74,12 @@ void popcli (void)
         panic("popcli - interruptible");
     }
 
-    if (--cpu->ncli < 0) {
-        cprintf("cpu (%d)->ncli: %d\n", cpu, cpu->ncli);
+    if (--mycpu()->ncli < 0) {
+        cprintf("cpu (%d)->ncli: %d\n", mycpu()->id, mycpu()->ncli);
         panic("popcli -- ncli < 0");
     }
 
-    if ((cpu->ncli == 0) && cpu->intena) {
+    if ((mycpu()->ncli == 0) && mycpu()->intena) {
         sti();
     }
 }
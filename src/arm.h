@@ -1,7 +1,12 @@
 #ifndef ARM_INCLUDE
 #define ARM_INCLUDE
 
+// the board is chosen in the Makefile
+#if defined(BOARD_REALVIEW_EB_MPCORE)
+#include "device/realview_eb_mpcore.h"
+#else
 #include "device/versatile_pb.h"
+#endif
 
 // trap frame: in ARM, there are seven modes. Among the 16 regular registers,
 // r13 (sp), r14(lr), r15(pc) are banked in all modes.
@@ -56,6 +61,60 @@ struct trapframe {
 #define UND_MODE    0x1b
 #define SYS_MODE    0x1f
 
+#ifndef __ASSEMBLER__
+// Data memory barrier (ARMv6 CP15 form)
+static inline void dmb (void)
+{
+    asm volatile("MCR p15, 0, %[r], c7, c10, 5": :[r]"r" (0):"memory");
+}
+
+// Make instructions just stored at [va, va+len) visible to the
+// instruction fetch (ARMv6 CP15 forms): clean the data cache lines
+// to memory, then invalidate the instruction cache and the branch
+// predictor, and wait for all of that to complete.
+#define CACHE_LINE  32
+
+static inline void sync_icache (void *va, uint len)
+{
+    uint a;
+
+    for (a = (uint) va & ~(CACHE_LINE - 1); a < (uint) va + len; a += CACHE_LINE) {
+        asm volatile("MCR p15, 0, %[r], c7, c10, 1": :[r]"r" (a):"memory");
+    }
+
+    asm volatile("MCR p15, 0, %[r], c7, c10, 4": :[r]"r" (0):"memory");
+    asm volatile("MCR p15, 0, %[r], c7, c5, 0": :[r]"r" (0):"memory");
+    asm volatile("MCR p15, 0, %[r], c7, c5, 6": :[r]"r" (0):"memory");
+    asm volatile("MCR p15, 0, %[r], c7, c5, 4": :[r]"r" (0):"memory");
+}
+
+// Wait for interrupt (ARMv6 CP15 form). The CPU wakes up on an
+// interrupt even if it is masked in the CPSR.
+static inline void wfi (void)
+{
+    asm volatile("MCR p15, 0, %[r], c7, c0, 4": :[r]"r" (0):"memory");
+}
+
+// Atomically swap *addr and newval, returning the old value
+// (for spinlocks). The barrier after the swap keeps the
+// accesses that follow from moving before it.
+static inline uint xchg (volatile uint *addr, uint newval)
+{
+    uint old, fail;
+
+    do {
+        asm volatile("LDREX %[o], [%[a]]\n\t"
+                     "STREX %[f], %[n], [%[a]]"
+                     : [o]"=&r" (old), [f]"=&r" (fail)
+                     : [a]"r" (addr), [n]"r" (newval)
+                     : "memory");
+    } while (fail);
+
+    dmb();
+    return old;
+}
+#endif
+
 // vector table
 #define TRAP_RESET  0
 #define TRAP_UND    1
@@ -5,6 +5,15 @@
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// The buffers are allocated from a slab cache at boot time,
+// (PHYSTOP >> BCACHE_SHIFT) bytes worth of them, but no fewer
+// than NBUF. Each holds a block of the root file system, whose
+// size (BSIZE) fsinit has read from the super block; the data of
+// PTE_SZ / BSIZE buffers share a page. Besides the LRU list, every
+// buffer is chained into a hash table indexed by (dev, blockno), so
+// a lookup only examines the few buffers in one bucket instead of
+// the whole cache.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -12,6 +21,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To warm the cache for a block that will be needed soon,
+//     call breadahead. It never sleeps and returns no buffer.
 //
 // The implementation uses three state flags internally:
 // * B_BUSY: the block has been returned from bread
@@ -19,34 +30,99 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_READAHEAD: the buffer was filled by breadahead
+//     and nobody has bread it yet.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "arm.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "buf.h"
 
+#define BHASH(dev, blockno)  (((blockno) ^ ((dev) << 8)) & (NBHASH - 1))
+
 struct {
     struct spinlock lock;
-    struct buf buf[NBUF];
+    int nbuf;                   // number of buffers in the cache
+    struct buf **hash;          // NBHASH chains, through hnext
+
+    uint ra_issued;             // blocks read ahead
+    uint ra_hits;               // read-ahead blocks later asked for
+    uint ra_wasted;             // read-ahead blocks evicted unused
 
     // Linked list of all buffers, through prev/next.
     // head.next is most recently used.
     struct buf head;
 } bcache;
 
+// Insert b into the hash chain for its (dev, blockno).
+static void bhash_insert (struct buf *b)
+{
+    struct buf **bh;
+
+    bh = &bcache.hash[BHASH(b->dev, b->blockno)];
+    b->hnext = *bh;
+    *bh = b;
+}
+
+// Remove b from its hash chain. The chains are short,
+// so we just walk the bucket to find the link to patch.
+static void bhash_remove (struct buf *b)
+{
+    struct buf **pp;
+
+    for (pp = &bcache.hash[BHASH(b->dev, b->blockno)]; *pp != 0; pp = &(*pp)->hnext) {
+        if (*pp == b) {
+            *pp = b->hnext;
+            b->hnext = 0;
+            return;
+        }
+    }
+}
+
 void binit (void)
 {
+    struct kmem_cache *cache;
     struct buf *b;
+    char *mem;
+    int i;
 
     initlock(&bcache.lock, "bcache");
 
+    // the hash table takes one page of bucket heads
+    if (NBHASH * sizeof(struct buf*) > PTE_SZ) {
+        panic("binit: NBHASH too big");
+    }
+
+    if ((bcache.hash = alloc_page()) == 0) {
+        panic("binit: no memory for hash table");
+    }
+
+    memset(bcache.hash, 0, PTE_SZ);
+
     //PAGEBREAK!
     // Create linked list of buffers
     bcache.head.prev = &bcache.head;
     bcache.head.next = &bcache.head;
 
-    for (b = bcache.buf; b < bcache.buf + NBUF; b++) {
+    cache = kmem_cache_create("buf", sizeof(struct buf), 0);
+    bcache.nbuf = UMAX((PHYSTOP >> BCACHE_SHIFT) / (sizeof(struct buf) + BSIZE), NBUF);
+    mem = 0;
+
+    for (i = 0; i < bcache.nbuf; i++) {
+        if ((i % (PTE_SZ / BSIZE) == 0) && ((mem = alloc_page()) == 0)) {
+            panic("binit: no memory for buffers");
+        }
+
+        if ((b = kmem_cache_alloc(cache)) == 0) {
+            panic("binit: no memory for buffers");
+        }
+
+        memset(b, 0, sizeof(*b));
+        b->data = (uchar*) mem + (i % (PTE_SZ / BSIZE)) * BSIZE;
+
         b->next = bcache.head.next;
         b->prev = &bcache.head;
         b->dev = -1;
@@ -55,50 +131,92 @@ void binit (void)
     }
 }
 
-// Look through buffer cache for sector on device dev.
+// Find the cached buffer for blockno on device dev, or 0.
+// Caller must hold bcache.lock.
+static struct buf* blookup (uint dev, uint blockno)
+{
+    struct buf *b;
+
+    for (b = bcache.hash[BHASH(dev, blockno)]; b != 0; b = b->hnext) {
+        if (b->dev == dev && b->blockno == blockno) {
+            return b;
+        }
+    }
+
+    return 0;
+}
+
+// Recycle the least recently used non-busy and clean buffer
+// for blockno on device dev, or return 0 if there is none.
+// Caller must hold bcache.lock.
+static struct buf* brecycle (uint dev, uint blockno)
+{
+    struct buf *b;
+
+    for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
+        if ((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0) {
+            if (b->flags & B_READAHEAD) {
+                bcache.ra_wasted++;
+            }
+
+            if (b->dev != -1) {
+                bhash_remove(b);
+            }
+
+            b->dev = dev;
+            b->blockno = blockno;
+            b->flags = B_BUSY;
+            bhash_insert(b);
+            return b;
+        }
+    }
+
+    return 0;
+}
+
+// Look through buffer cache for blockno on device dev.
 // If not found, allocate fresh block.
 // In either case, return B_BUSY buffer.
-static struct buf* bget (uint dev, uint sector)
+static struct buf* bget (uint dev, uint blockno)
 {
     struct buf *b;
 
     acquire(&bcache.lock);
 
     loop:
-    // Is the sector already cached?
-    for (b = bcache.head.next; b != &bcache.head; b = b->next) {
-        if (b->dev == dev && b->sector == sector) {
-            if (!(b->flags & B_BUSY)) {
-                b->flags |= B_BUSY;
-                release(&bcache.lock);
-                return b;
+    // Is the block already cached?
+    if ((b = blookup(dev, blockno)) != 0) {
+        if (!(b->flags & B_BUSY)) {
+            b->flags |= B_BUSY;
+
+            if (b->flags & B_READAHEAD) {
+                b->flags &= ~B_READAHEAD;
+                bcache.ra_hits++;
             }
 
-            sleep(b, &bcache.lock);
-            goto loop;
+            release(&bcache.lock);
+            return b;
         }
+
+        sleep(b, &bcache.lock);
+        goto loop;
     }
 
     // Not cached; recycle some non-busy and clean buffer.
-    for (b = bcache.head.prev; b != &bcache.head; b = b->prev) {
-        if ((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0) {
-            b->dev = dev;
-            b->sector = sector;
-            b->flags = B_BUSY;
-            release(&bcache.lock);
-            return b;
-        }
+    if ((b = brecycle(dev, blockno)) == 0) {
+        panic("bget: no buffers");
     }
 
-    panic("bget: no buffers");
+    release(&bcache.lock);
+    return b;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
-struct buf* bread (uint dev, uint sector)
+// Return a B_BUSY buf with the contents of the indicated disk block.
+struct buf* bread (uint dev, uint blockno)
 {
     struct buf *b;
 
-    b = bget(dev, sector);
+    b = bget(dev, blockno);
 
     if (!(b->flags & B_VALID)) {
         iderw(b);
@@ -107,6 +225,30 @@ struct buf* bread (uint dev, uint sector)
     return b;
 }
 
+// Start filling the buffer for blockno on device dev ahead of demand.
+// Unlike bread this never sleeps and returns nothing: if the block
+// is already cached (or being read), or every buffer is in use, the
+// read-ahead is simply skipped. The buffer is released once the
+// read completes; the memory disk completes it before iderw returns.
+void breadahead (uint dev, uint blockno)
+{
+    struct buf *b;
+
+    acquire(&bcache.lock);
+
+    if (blookup(dev, blockno) != 0 || (b = brecycle(dev, blockno)) == 0) {
+        release(&bcache.lock);
+        return;
+    }
+
+    b->flags |= B_READAHEAD;
+    bcache.ra_issued++;
+    release(&bcache.lock);
+
+    iderw(b);
+    brelse(b);
+}
+
 // Write b's contents to disk.  Must be B_BUSY.
 void bwrite (struct buf *b)
 {
@@ -141,3 +283,9 @@ void brelse (struct buf *b)
     release(&bcache.lock);
 }
 
+// Print buffer cache statistics to the console.
+void bstat (void)
+{
+    cprintf("bcache: %d bufs, read-ahead %d issued %d hits %d wasted\n",
+            bcache.nbuf, bcache.ra_issued, bcache.ra_hits, bcache.ra_wasted);
+}
@@ -6,6 +6,7 @@
 #include "mmu.h"
 #include "spinlock.h"
 #include "arm.h"
+#include "proc.h"
 
 
 // this file implement the buddy memory allocator. Each order divides
@@ -14,6 +15,15 @@
 // when blocks are freed. We also use double-linked list to chain together
 // free blocks (for each order), thus allowing fast allocation. There is
 // about 8% overhead (maximum) for this structure.
+//
+// Pages and page tables, the blocks allocated and freed most often,
+// are cached in per-CPU magazines (struct magazine in proc.h). They
+// are served without kmem.lock, with interrupts off, and move to and
+// from the buddy system MAG_BATCH blocks at a time. Blocks in the
+// magazines are not counted in nfree, but in free_pages(). When an
+// allocation fails, the magazines are emptied, since the blocks in
+// them may merge into the one wanted: right away on this CPU, and
+// by the other CPUs at their next kmalloc or kfree.
 
 #define MAX_ORD      12
 #define MIN_ORD      6
@@ -40,11 +50,15 @@ struct kmem {
     uint            start;             // start of memory for marks
     uint            start_heap;        // start of allocatable memory
     uint            end;
+    uint            nfree;             // free memory (bytes)
+    uint            nlock;             // acquisitions of lock
     struct order    orders[N_ORD];  // orders used for buddy systems
 };
 
 static struct kmem kmem;
 
+void _kfree (void *mem, int order);
+
 // coversion between block id to mark and memory address
 static inline struct mark* get_mark (int order, int idx)
 {
@@ -107,7 +121,8 @@ void kmem_init2(void *vstart, void *vend)
     kmem.start_heap = align_up(kmem.start + total * sizeof(*mk), 1 << MAX_ORD);
     
     for (i = kmem.start_heap; i < kmem.end; i += (1 << MAX_ORD)){
-        kfree ((void*)i, MAX_ORD);
+        _kfree ((void*)i, MAX_ORD);
+        kmem.nfree += 1 << MAX_ORD;
     }
 }
 
@@ -215,8 +230,83 @@ static void* get_blk (int order)
     return NULL;
 }
 
-void _kfree (void *mem, int order);
+static void *_kmalloc (int order);
 
+// orders of the blocks cached in cpu->mag[]
+static const int mag_order[NMAG] = { PTE_SHIFT, PT_ORDER };
+
+// the per-CPU magazine for blocks of order, 0 if there is none
+static struct magazine* get_mag (int order)
+{
+    int i;
+
+    for (i = 0; i < NMAG; i++) {
+        if (mag_order[i] == order) {
+            return &mycpu()->mag[i];
+        }
+    }
+
+    return 0;
+}
+
+// move up to n blocks from the buddy system to magazine m
+static void mag_refill (struct magazine *m, int order, int n)
+{
+    void *up;
+
+    acquire(&kmem.lock);
+    kmem.nlock++;
+
+    while ((n-- > 0) && (m->n < MAG_SIZE) && ((up = _kmalloc(order)) != NULL)) {
+        m->blk[m->n++] = up;
+        kmem.nfree -= 1 << order;
+    }
+
+    release(&kmem.lock);
+}
+
+// return up to n blocks from magazine m to the buddy system
+static void mag_drain (struct magazine *m, int order, int n)
+{
+    acquire(&kmem.lock);
+    kmem.nlock++;
+
+    while ((n-- > 0) && (m->n > 0)) {
+        _kfree(m->blk[--m->n], order);
+        kmem.nfree += 1 << order;
+    }
+
+    release(&kmem.lock);
+}
+
+// return all the blocks in the magazines of this CPU to the buddy
+// system. Caller holds kmem.lock, with interrupts off.
+static void mag_flush (void)
+{
+    struct magazine *m;
+    int i;
+
+    for (i = 0; i < NMAG; i++) {
+        for (m = &mycpu()->mag[i]; m->n > 0; ) {
+            _kfree(m->blk[--m->n], mag_order[i]);
+            kmem.nfree += 1 << mag_order[i];
+        }
+    }
+
+    mycpu()->magflush = 0;
+}
+
+// empty the magazines of this CPU if another one has asked for it.
+// Caller has interrupts off.
+static void mag_check (void)
+{
+    if (mycpu()->magflush) {
+        acquire(&kmem.lock);
+        kmem.nlock++;
+        mag_flush();
+        release(&kmem.lock);
+    }
+}
 
 static void *_kmalloc (int order)
 {
@@ -244,15 +334,59 @@ static void *_kmalloc (int order)
 // allocate memory that has the size of (1 << order)
 void *kmalloc (int order)
 {
-    uint8         *up;
+    struct magazine *m;
+    uint8 *up;
+    int i;
 
     if ((order > MAX_ORD) || (order < MIN_ORD)) {
         panic("kmalloc: order out of range\n");
     }
 
+    pushcli();
+    mag_check();
+
+    if ((m = get_mag(order)) != 0) {
+        m->alloc++;
+
+        if (m->n > 0) {
+            m->hit++;
+        } else {
+            mag_refill(m, order, MAG_BATCH);
+        }
+
+        if (m->n > 0) {
+            up = m->blk[--m->n];
+            popcli();
+            return up;
+        }
+
+        // the refill failed, fall back on the buddy system below
+    }
+
     acquire(&kmem.lock);
+    kmem.nlock++;
     up = _kmalloc(order);
+
+    // a larger block may be held up in pieces in the magazines: empty
+    // ours and try again, and have the other CPUs empty theirs too
+    if (up == NULL) {
+        mag_flush();
+
+        for (i = 0; i < ncpu; i++) {
+            if (&cpus[i] != mycpu()) {
+                cpus[i].magflush = 1;
+            }
+        }
+
+        up = _kmalloc(order);
+    }
+
+    if (up != NULL) {
+        kmem.nfree -= 1 << order;
+    }
+
     release(&kmem.lock);
+    popcli();
 
     return up;
 }
@@ -284,13 +418,31 @@ void _kfree (void *mem, int order)
 // storing size info somewhere which might break the alignment
 void kfree (void *mem, int order)
 {
+    struct magazine *m;
+
     if ((order > MAX_ORD) || (order < MIN_ORD) || (uint)mem & ((1<<order) -1)) {
         panic("kfree: order out of range or memory unaligned\n");
     }
 
+    pushcli();
+    mag_check();
+
+    if ((m = get_mag(order)) != 0) {
+        if (m->n == MAG_SIZE) {
+            mag_drain(m, order, MAG_BATCH);
+        }
+
+        m->blk[m->n++] = mem;
+        popcli();
+        return;
+    }
+
     acquire(&kmem.lock);
+    kmem.nlock++;
     _kfree(mem, order);
+    kmem.nfree += 1 << order;
     release(&kmem.lock);
+    popcli();
 }
 
 // free a page
@@ -305,6 +457,45 @@ void* alloc_page (void)
     return kmalloc (PTE_SHIFT);
 }
 
+// number of free pages (including those in smaller free blocks)
+int free_pages (void)
+{
+    struct cpu *c;
+    uint n;
+    int i;
+
+    n = kmem.nfree;
+
+    for (c = cpus; c < cpus + NCPU; c++) {
+        for (i = 0; i < NMAG; i++) {
+            n += c->mag[i].n << mag_order[i];
+        }
+    }
+
+    return n >> PTE_SHIFT;
+}
+
+// Print statistics of the allocator to the console.
+void kmstat (void)
+{
+    struct cpu *c;
+    struct magazine *m;
+    int i;
+
+    cprintf("kmem: %d KB free, %d lock acquisitions\n", kmem.nfree >> 10, kmem.nlock);
+
+    for (c = cpus; c < cpus + NCPU; c++) {
+        for (i = 0; i < NMAG; i++) {
+            m = &c->mag[i];
+
+            if (m->alloc != 0) {
+                cprintf("kmem: cpu%d order %d: %d cached, %d/%d hits\n",
+                        c->id, mag_order[i], m->n, m->hit, m->alloc);
+            }
+        }
+    }
+}
+
 // round up power of 2, then get the order
 //   http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2
 int get_order (uint32 v)
@@ -4,15 +4,17 @@
 struct buf {
     int        flags;
     uint       dev;
-    uint       sector;
+    uint       blockno;
     struct buf *prev;  // LRU cache list
     struct buf *next;
+    struct buf *hnext; // hash chain for (dev, blockno)
     struct buf *qnext; // disk queue
-    uchar      data[512];
+    uchar      *data;  // BSIZE bytes
 };
 
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_READAHEAD 0x8  // filled by read-ahead, not yet asked for
 
 #endif
@@ -124,7 +124,7 @@ void panic (char *s)
 
     cons.locking = 0;
 
-    cprintf("cpu%d: panic: ", cpu->id);
+    cprintf("cpu%d: panic: ", mycpu()->id);
 
     show_callstk(s);
     panicked = 1; // freeze other CPU
@@ -178,6 +178,16 @@ void consoleintr (int (*getc) (void))
             procdump();
             break;
 
+        case C('T'):  // Kernel statistics.
+            bstat();
+            vmstat();
+            pcstat();
+            istat();
+            dcachestat();
+            kmstat();
+            slabstat();
+            break;
+
         case C('U'):  // Kill line.
             while ((input.e != input.w) && (input.buf[(input.e - 1) % INPUT_BUF] != '\n')) {
                 input.e--;
@@ -227,7 +237,7 @@ int consoleread (struct inode *ip, char *dst, int n)
 
     while (n > 0) {
         while (input.r == input.w) {
-            if (proc->killed) {
+            if (myproc()->killed) {
                 release(&input.lock);
                 ilock(ip);
                 return -1;
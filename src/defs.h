@@ -14,12 +14,16 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct ktimer;
 struct pipe;
 struct proc;
+struct rusage;
 struct spinlock;
 struct stat;
 struct superblock;
 struct trapframe;
+struct vma;
 
 typedef uint32	pte_t;
 typedef uint32  pde_t;
@@ -42,7 +46,9 @@ void            show_callstk (char *);
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadahead(uint, uint);
 void            brelse(struct buf*);
+void            bstat(void);
 void            bwrite(struct buf*);
 
 // buddy.c
@@ -52,6 +58,8 @@ void*           kmalloc (int order);
 void            kfree (void *mem, int order);
 void            free_page(void *v);
 void*           alloc_page (void);
+void            kmstat(void);
+int             free_pages (void);
 void            kmem_test_b (void);
 int             get_order (uint32 v);
 
@@ -74,9 +82,15 @@ int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
+extern uint     fsbsize;        // block size of the root file system
+#define BSIZE   fsbsize
+void            fsinit(int);
+void            fsmount(int);
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
+void            dcachestat(void);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(void);
@@ -85,6 +99,7 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            istat(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -103,34 +118,66 @@ void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 void            kmem_init (void);*/
 
+// ktimer.c
+void            ktimer_init(void);
+void            ktimer_add(struct ktimer*, uint);
+void            ktimer_del(struct ktimer*);
+void            ktimer_run(void);
+uint            ktimer_next(uint);
+
 // log.c
 void            initlog(void);
 void            log_write(struct buf*);
 void            begin_trans();
 void            commit_trans();
+void            begin_ntrans(int);
+void            commit_ntrans(int);
+int             log_maxblocks(void);
+
+// pcache.c
+void            pcinit(void);
+uint            pcache_get(struct inode*, uint, int);
+void            pcache_inval(struct inode*);
+void            pcache_update(struct inode*, char*, uint, uint);
+void            pcstat(void);
 
-// picirq.c
+// mpcore.c
+int             cpuid(void);
+int             mp_ncpu(void);
+void            mp_startothers(void);
+
+// picirq.c or gic.c
 void            pic_enable(int, ISR);
 void            pic_init(void*);
+void            pic_init_cpu(void);
+void            pic_sgi_others(int);
 void            pic_dispatch (struct trapframe *tp);
 
 // pipe.c
-int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
+int             pipealloc(struct file**, struct file**, uint);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipefromfile(struct pipe*, struct file*, int);
+int             pipetofile(struct pipe*, struct file*, int);
 
 //PAGEBREAK: 16
 // proc.c
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
+int             getrusage(int, struct rusage*);
 int             growproc(int);
 int             kill(int);
+int             setprio(int, int);
+struct proc*    myproc(void);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             sched_tick(int);
+int             sched_timer(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
@@ -140,6 +187,13 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabstat(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -164,12 +218,16 @@ int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
+void            timer_busy(void);
 void            timer_init(int hz);
+void            timer_sync(void);
+void            timer_wakeup(uint);
 extern struct   spinlock tickslock;
 
 // trap.c
 extern uint     ticks;
 void            trap_init(void);
+void            trap_init_stacks(void);
 void            dump_trapframe (struct trapframe *tf);
 
 // trap_asm.S
@@ -194,8 +252,22 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, struct vma*);
+int             reserveuvm(pde_t*, uint, uint);
+int             uvm_fault(struct proc*, uint, uint);
+int             uvm_prefault(struct proc*, uint, uint);
+uint            uvm_limit(struct proc*, uint);
+uint            uvm_mmap(struct proc*, struct inode*, uint, uint, int);
+int             uvm_mapped(struct proc*, uint, uint);
+int             uvm_munmap(struct proc*, uint, uint);
+void            vmstat(void);
+char*           alloc_upage(void);
+void            dup_upage(uint);
+void            free_upage(uint);
+int             upage_ref(uint);
+void            dupvmas(struct vma*, struct vma*);
+void            freevmas(struct vma*);
+void            syncvmas(struct proc*);
 void            switchuvm(struct proc*);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
@@ -0,0 +1,141 @@
+// Support of the ARM Generic Interrupt Controller, as found in the
+// ARM11 MPCore (and later) multi-core processors.
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "arm.h"
+#include "memlayout.h"
+#include "mmu.h"
+
+// The GIC has a distributor, shared by all the cores, that routes
+// each interrupt to some cores, and a CPU interface per core (at
+// the same address on every core). The flow to handle interrupts:
+//		1. an interrupt (IRQ) occurs, trap.c branches to our IRQ handler
+//		2. read the interrupt acknowledge register for the ID of the
+//		   highest priority pending interrupt, until it is spurious:
+//			2.1 locate the correct ISR
+//			2.2 execute the ISR
+//			2.3 write the ID to the end of interrupt register
+//		3 return to trap.c, which will resume interrupted routines
+// Interrupts 0-15 are software generated (SGI) and 16-31 private to
+// each core; the board's interrupts (SPI) start at 32.
+
+static volatile uint* gic_dist;
+static volatile uint* gic_cpu;
+
+// distributor registers (in the unit of 4 bytes)
+#define GICD_CTLR		(0x000/4) // enable forwarding to the CPU interfaces
+#define GICD_TYPER		(0x004/4) // number of interrupts supported
+#define GICD_ISENABLER	(0x100/4) // set-enable bits
+#define GICD_ICENABLER	(0x180/4) // clear-enable bits
+#define GICD_IPRIORITYR	(0x400/4) // priorities, a byte per interrupt
+#define GICD_ITARGETSR	(0x800/4) // target cores, a byte per interrupt
+#define GICD_SGIR		(0xF00/4) // send software generated interrupts
+
+// CPU interface registers (in the unit of 4 bytes)
+#define GICC_CTLR		(0x00/4)  // enable signalling to the core
+#define GICC_PMR		(0x04/4)  // priority mask
+#define GICC_IAR		(0x0C/4)  // interrupt acknowledge
+#define GICC_EOIR		(0x10/4)  // end of interrupt
+
+#define GIC_SPURIOUS	1023
+#define SGI_OTHERS		(1 << 24) // SGI target filter: all but this core
+
+#define NUM_INTSRC		96 // numbers of interrupt source supported
+
+static ISR isrs[NUM_INTSRC];
+
+static void default_isr (struct trapframe *tf, int n)
+{
+    cprintf ("unhandled interrupt: %d\n", n);
+}
+
+// initialize the GIC distributor and this core's CPU interface
+void pic_init (void * base)
+{
+    int i;
+
+    gic_dist = base;
+    gic_cpu = P2V(GIC_CPU_BASE);
+
+    gic_dist[GICD_CTLR] = 0;
+
+    for (i = 0; i < NUM_INTSRC; i += 32) {
+        gic_dist[GICD_ICENABLER + i / 32] = 0xFFFFFFFF;
+    }
+
+    for (i = 0; i < NUM_INTSRC; i++) {
+        isrs[i] = default_isr;
+    }
+
+    gic_dist[GICD_CTLR] = 1;
+    pic_init_cpu ();
+}
+
+// enable the CPU interface of this core, so that it gets the
+// interrupts routed to it. Every core calls this when it starts.
+void pic_init_cpu (void)
+{
+    // the enable bits of the SGIs, used to interrupt other cores,
+    // are banked: each core has to enable its own
+    gic_dist[GICD_ISENABLER] = 0x0000FFFF;
+
+    gic_cpu[GICC_PMR] = 0xF0;
+    gic_cpu[GICC_CTLR] = 1;
+}
+
+// enable an interrupt (with the ISR). The board's interrupts
+// are delivered to the first core.
+void pic_enable (int n, ISR isr)
+{
+    volatile uchar *b;
+
+    if ((n<0) || (n >= NUM_INTSRC)) {
+        panic ("invalid interrupt source");
+    }
+
+    isrs[n] = isr;
+
+    b = (volatile uchar*) (gic_dist + GICD_IPRIORITYR);
+    b[n] = 0xA0;
+
+    if (n >= 32) {
+        b = (volatile uchar*) (gic_dist + GICD_ITARGETSR);
+        b[n] = 0x01;
+    }
+
+    // write 1 bit enable the interrupt, 0 bit has no effect
+    gic_dist[GICD_ISENABLER + n / 32] = 1 << (n % 32);
+}
+
+// disable an interrupt
+void pic_disable (int n)
+{
+    if ((n<0) || (n >= NUM_INTSRC)) {
+        panic ("invalid interrupt source");
+    }
+
+    gic_dist[GICD_ICENABLER + n / 32] = 1 << (n % 32);
+    isrs[n] = default_isr;
+}
+
+// send software generated interrupt n to all the other cores
+void pic_sgi_others (int n)
+{
+    gic_dist[GICD_SGIR] = SGI_OTHERS | n;
+}
+
+// dispatch the interrupt
+void pic_dispatch (struct trapframe *tp)
+{
+    uint iar;
+    int n;
+
+    while ((n = (iar = gic_cpu[GICC_IAR]) & 0x3FF) != GIC_SPURIOUS) {
+        if (n < NUM_INTSRC) {
+            isrs[n](tp, n);
+        }
+
+        gic_cpu[GICC_EOIR] = iar;
+    }
+}
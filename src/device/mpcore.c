@@ -0,0 +1,61 @@
+// Multi-core support of the ARM11 MPCore: find out how many cores
+// there are, and start the others.
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "arm.h"
+#include "memlayout.h"
+#include "mmu.h"
+
+#define SCU_CONFIG		1	// SCU configuration register (in the unit of 4 bytes)
+
+extern void _start (void);
+extern uint ap_release;
+
+// the ID (0 to 3) of the core we are running on
+int cpuid (void)
+{
+    uint val;
+
+    // read the CPU ID register (MPIDR)
+    asm("MRC p15, 0, %[r], c0, c0, 5": [r]"=r" (val)::);
+    return val & 0x0F;
+}
+
+// the number of cores in the MPCore
+int mp_ncpu (void)
+{
+    volatile uint *scu = P2V(SCU_BASE);
+
+    return (scu[SCU_CONFIG] & 0x03) + 1;
+}
+
+// SGI used to wake up the other cores; nothing to do
+static void isr_ipi (struct trapframe *tp, int irq_idx)
+{
+}
+
+// Release the other cores, which all start at _start (entry.S).
+// Under QEMU, they start with core 0 and wait there on ap_release;
+// on the board, the boot monitor holds them until SYS_FLAGS has
+// an address to jump to, and an interrupt wakes them up.
+void mp_startothers (void)
+{
+    uint val;
+
+    *(volatile uint*) P2V(&ap_release) = 1;
+
+    // the other cores still run with the caches off: write back
+    // the data cache, and wait for that to complete
+    val = 0;
+    asm("MCR p15, 0, %[r], c7, c10, 0": :[r]"r" (val):);
+    asm("MCR p15, 0, %[r], c7, c10, 4": :[r]"r" (val):);
+    asm("SEV");
+
+    pic_enable (PIC_IPI, isr_ipi);
+
+    *(volatile uint*) P2V(SYS_FLAGSCLR) = 0xFFFFFFFF;
+    *(volatile uint*) P2V(SYS_FLAGSSET) = (uint) _start;
+
+    pic_sgi_others (PIC_IPI);
+}
@@ -0,0 +1,47 @@
+//
+// Board specific information for the RealView Emulation Baseboard
+// with the ARM11 MPCore tile (QEMU: -M realview-eb-mpcore)
+//
+#ifndef REALVIEW_EB_MPCORE
+#define REALVIEW_EB_MPCORE
+
+
+// we assume the board has 128MB memory (at 0)
+#define PHYSTOP         0x08000000
+#define BSP_MEMREMAP    0x04000000
+
+#define DEVBASE         0x10000000
+#define DEV_MEM_SZ      0x08000000
+#define VEC_TBL         0xFFFF0000
+
+
+#define STACK_FILL      0xdeadbeef
+
+#define UART0           0x10009000
+#define UART_CLK        24000000    // Clock rate for UART
+
+#define TIMER0          0x10011000
+#define TIMER1          0x10011020
+#define CLK_HZ          1000000     // the clock is 1MHZ
+
+// system registers: the boot monitor holds the secondary cores in
+// a loop until SYS_FLAGS has the address for them to jump to
+#define SYS_FLAGSSET    0x10000030
+#define SYS_FLAGSCLR    0x10000034
+
+// MPCore private memory region: snoop control unit, and the
+// generic interrupt controller (distributor and CPU interfaces)
+#define SCU_BASE        0x10100000
+#define GIC_CPU_BASE    0x10100100
+#define GIC_DIST_BASE   0x10101000
+#define PIC_BASE        GIC_DIST_BASE
+
+#define BOARD_NCPU      4           // most cores an ARM11 MPCore has
+
+// interrupt IDs, the board's interrupts start at 32 in the GIC
+#define PIC_IPI         0           // SGI 0 wakes up other cores
+#define PIC_TIMER01     33
+#define PIC_TIMER23     34
+#define PIC_UART0       36
+
+#endif
@@ -7,7 +7,10 @@
 #include "memlayout.h"
 #include "spinlock.h"
 
-// A SP804 has two timers, we only use the first one, and as perodic timer
+// A SP804 has two timers. Timer 1 runs freely as the clock source,
+// from which ticks is kept up to date. Timer 0 is a one-shot timer,
+// programmed for the next tick at which a kernel timer is due; no
+// interrupt is taken for the ticks in between (tickless).
 
 // define registers (in units of 4-bytes)
 #define TIMER_LOAD	   0	// load register, for perodic timer
@@ -23,11 +26,20 @@
 #define TIMER_PERIODIC 0x40	// enable periodic mode
 #define TIMER_EN       0x80	// enable the timer
 
+// the longest time between two timer interrupts, in ticks. ticks
+// must be brought up to date before the 32-bit clock source wraps.
+#define MAX_IDLE       (10 * HZ)
+
 void isr_timer (struct trapframe *tp, int irq_idx);
 
 struct spinlock tickslock;
 uint ticks;
 
+static uint cyc_per_tick;   // clock source cycles per tick
+static uint clk_last;       // clock source at the last timer_sync
+static uint clk_rem;        // cycles from the start of the tick to clk_last
+static uint next_event;     // tick timer 0 is programmed to interrupt at
+
 // acknowledge the timer, write any value to TIMER_INTCLR should do
 static void ack_timer ()
 {
@@ -35,43 +47,112 @@ static void ack_timer ()
     timer0[TIMER_INTCLR] = 1;
 }
 
-// initialize the timer: perodical and interrupt based
-void timer_init(int hz)
+// program timer 0 to interrupt at the start of tick next
+static void timer_program (uint next)
 {
     volatile uint * timer0 = P2V(TIMER0);
 
+    next_event = next;
+
+    timer0[TIMER_CONTROL] = 0;
+    timer0[TIMER_LOAD] = (next - ticks) * cyc_per_tick - clk_rem;
+    timer0[TIMER_CONTROL] = TIMER_EN|TIMER_ONESHOT|TIMER_32BIT|TIMER_INTEN;
+}
+
+// initialize the timers: timer 1 as the free-running clock source,
+// timer 0 as the one-shot, interrupt based event timer
+void timer_init(int hz)
+{
+    volatile uint * timer1 = P2V(TIMER1);
+
     initlock(&tickslock, "time");
+    ktimer_init();
 
-    timer0[TIMER_LOAD] = CLK_HZ / hz;
-    timer0[TIMER_CONTROL] = TIMER_EN|TIMER_PERIODIC|TIMER_32BIT|TIMER_INTEN;
+    cyc_per_tick = CLK_HZ / hz;
+
+    // the counter wraps to 0xFFFFFFFF after it decrements to 0
+    timer1[TIMER_CONTROL] = 0;
+    timer1[TIMER_LOAD] = 0xFFFFFFFF;
+    timer1[TIMER_CONTROL] = TIMER_EN|TIMER_32BIT;
+    clk_last = timer1[TIMER_CURVAL];
+
+    acquire(&tickslock);
+    timer_program(ticks + MAX_IDLE);
+    release(&tickslock);
 
     pic_enable (PIC_TIMER01, isr_timer);
 }
 
-// interrupt service routine for the timer
-void isr_timer (struct trapframe *tp, int irq_idx)
+// Bring ticks up to date with the clock source, and fire the kernel
+// timers that have expired since. Caller holds tickslock.
+void timer_sync (void)
 {
+    volatile uint * timer1 = P2V(TIMER1);
+    uint now;
+
+    now = timer1[TIMER_CURVAL];
+    clk_rem += clk_last - now;
+    clk_last = now;
+
+    if (clk_rem >= cyc_per_tick) {
+        ticks += clk_rem / cyc_per_tick;
+        clk_rem %= cyc_per_tick;
+        ktimer_run();
+    }
+}
+
+// Make sure the timer interrupts at tick next or earlier, as a
+// kernel timer is due then. Caller holds tickslock.
+void timer_wakeup (uint next)
+{
+    if ((int) (next - next_event) < 0) {
+        timer_program(next);
+    }
+}
+
+// A CPU is about to run processes: make the timer tick, if it does
+// not already, so that their quantum is enforced (see sched_tick).
+void timer_busy (void)
+{
+    // a quick check without the lock; being wrong costs one tick
+    if (next_event - ticks <= 1) {
+        return;
+    }
+
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    timer_sync();
+    timer_wakeup(ticks + 1);
     release(&tickslock);
+}
+
+// interrupt service routine for the timer. While processes are
+// running, the timer ticks for their accounting and quantum;
+// otherwise it is idle until the next kernel timer is due.
+void isr_timer (struct trapframe *tp, int irq_idx)
+{
+    uint limit;
+
     ack_timer();
+
+    acquire(&tickslock);
+    timer_sync();
+
+    limit = ticks + (sched_timer() ? 1 : MAX_IDLE);
+    timer_program(ktimer_next(limit));
+
+    release(&tickslock);
 }
 
-// a short delay, use timer 1 as the source
+// a short delay, use timer 1 (the clock source)
 void micro_delay (int us)
 {
     volatile uint * timer1 = P2V(TIMER1);
+    uint start;
 
-    // load the initial value to timer1, and configure it to be freerun
-    timer1[TIMER_CONTROL] = TIMER_EN | TIMER_32BIT;
-    timer1[TIMER_LOAD] = us;
+    // the counter counts down, one per microsecond
+    start = timer1[TIMER_CURVAL];
 
-    // the register will wrap to 0xFFFFFFFF after decrement to 0
-    while ((int)timer1[TIMER_CURVAL] > 0) {
+    while (start - timer1[TIMER_CURVAL] < us) {
 
     }
-
-    // disable timer
-    timer1[TIMER_CONTROL] = 0;
 }
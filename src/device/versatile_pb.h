@@ -27,6 +27,9 @@
 #define CLK_HZ          1000000     // the clock is 1MHZ
 
 #define VIC_BASE        0x10140000
+#define PIC_BASE        VIC_BASE
+
+#define BOARD_NCPU      1
 #define PIC_TIMER01     4
 #define PIC_TIMER23     5
 #define PIC_UART0       12
@@ -23,12 +23,19 @@ int exec (char *path, char **argv)
     uint sz;
     uint sp;
     uint ustack[3 + MAXARG + 1];
+    struct vma vma[NVMA];
+    struct vma *v;
+    struct proc *curproc;
+
+    curproc = myproc();
 
     if ((ip = namei(path)) == 0) {
         return -1;
     }
 
     ilock(ip);
+    memset(vma, 0, sizeof(vma));
+    v = vma;
 
     // Check ELF header
     if (readi(ip, (char*) &elf, 0, sizeof(elf)) < sizeof(elf)) {
@@ -45,7 +52,8 @@ int exec (char *path, char **argv)
         goto bad;
     }
 
-    // Load program into memory.
+    // Record the program segments; their pages are read from
+    // the file (or shared through the page cache) when touched.
     sz = 0;
 
     for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
@@ -61,13 +69,23 @@ int exec (char *path, char **argv)
             goto bad;
         }
 
-        if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0) {
+        if ((ph.vaddr + ph.memsz < ph.vaddr) || (ph.vaddr + ph.memsz >= UADDR_SZ)) {
             goto bad;
         }
 
-        if (loaduvm(pgdir, (char*) ph.vaddr, ip, ph.off, ph.filesz) < 0) {
+        if (v == &vma[NVMA]) {
             goto bad;
         }
+
+        v->ip = idup(ip);
+        v->vaddr = ph.vaddr;
+        v->memsz = ph.memsz;
+        v->off = ph.off;
+        v->filesz = ph.filesz;
+        v->flags = (ph.flags & ELF_PROG_FLAG_WRITE) ? VMA_WRITE : 0;
+        v++;
+
+        sz = UMAX(sz, ph.vaddr + ph.memsz);
     }
 
     iunlockput(ip);
@@ -103,8 +121,8 @@ int exec (char *path, char **argv)
     ustack[argc] = 0;
 
     // in ARM, parameters are passed in r0 and r1
-    proc->tf->r0 = argc;
-    proc->tf->r1 = sp - (argc + 1) * 4;
+    curproc->tf->r0 = argc;
+    curproc->tf->r1 = sp - (argc + 1) * 4;
 
     sp -= (argc + 1) * 4;
 
@@ -119,17 +137,26 @@ int exec (char *path, char **argv)
         }
     }
 
-    safestrcpy(proc->name, last, sizeof(proc->name));
+    safestrcpy(curproc->name, last, sizeof(curproc->name));
+
+    // Commit to the user image. The files mapped by the old
+    // image are unmapped, writing the shared ones back first.
+    syncvmas(curproc);
 
-    // Commit to the user image.
-    oldpgdir = proc->pgdir;
-    proc->pgdir = pgdir;
-    proc->sz = sz;
-    proc->tf->pc = elf.entry;
-    proc->tf->sp_usr = sp;
+    oldpgdir = curproc->pgdir;
+    curproc->pgdir = pgdir;
+    curproc->sz = sz;
+    curproc->tf->pc = elf.entry;
+    curproc->tf->sp_usr = sp;
 
-    switchuvm(proc);
+    switchuvm(curproc);
     freevm(oldpgdir);
+
+    begin_trans();
+    freevmas(curproc->vma);
+    commit_trans();
+    memmove(curproc->vma, vma, sizeof(vma));
+
     return 0;
 
     bad: if (pgdir) {
@@ -139,5 +166,10 @@ int exec (char *path, char **argv)
     if (ip) {
         iunlockput(ip);
     }
+
+    begin_trans();
+    freevmas(vma);
+    commit_trans();
+
     return -1;
 }
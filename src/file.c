@@ -10,14 +10,18 @@
 #include "spinlock.h"
 
 struct devsw devsw[NDEV];
+
+// the file structures come from a slab cache; the lock
+// protects their reference counts
 struct {
     struct spinlock lock;
-    struct file file[NFILE];
+    struct kmem_cache *cache;
 } ftable;
 
 void fileinit (void)
 {
     initlock(&ftable.lock, "ftable");
+    ftable.cache = kmem_cache_create("file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -25,18 +29,14 @@ struct file* filealloc (void)
 {
     struct file *f;
 
-    acquire(&ftable.lock);
-
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
+    if ((f = kmem_cache_alloc(ftable.cache)) == 0) {
+        return 0;
     }
 
-    release(&ftable.lock);
-    return 0;
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
+
+    return f;
 }
 
 // Increment ref count for file f.
@@ -74,6 +74,8 @@ void fileclose (struct file *f)
     f->type = FD_NONE;
     release(&ftable.lock);
 
+    kmem_cache_free(ftable.cache, f);
+
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
 
@@ -134,6 +136,7 @@ int filewrite (struct file *f, char *addr, int n)
     int i;
     int max;
     int n1;
+    int nblk;
 
     if (f->writable == 0) {
         return -1;
@@ -144,13 +147,18 @@ int filewrite (struct file *f, char *addr, int n)
     }
 
     if (f->type == FD_INODE) {
-        // write a few blocks at a time to avoid exceeding
-        // the maximum log transaction size, including
-        // i-node, indirect block, allocation blocks,
-        // and 2 blocks of slop for non-aligned writes.
+        // write as many blocks at a time as the log can take
+        // in one transaction, less the i-node, 3 indirect blocks
+        // (crossing into the double indirect range, or from one
+        // of its second-level blocks to the next, dirties three),
+        // 2 allocation blocks, and a block of slop for
+        // non-aligned writes. Rewritten blocks are absorbed in
+        // the cache, so each block counts once. Each chunk only
+        // reserves the log space it needs, so that small writes
+        // share a commit with other operations.
         // this really belongs lower down, since writei()
         // might be writing a device like the console.
-        max = ((LOGSIZE - 1 - 1 - 2) / 2) * 512;
+        max = (log_maxblocks() - 1 - 3 - 2 - 1) * BSIZE;
         i = 0;
 
         while (i < n) {
@@ -160,7 +168,11 @@ int filewrite (struct file *f, char *addr, int n)
                 n1 = max;
             }
 
-            begin_trans();
+            // the data blocks a chunk of n1 bytes touches at any offset
+            nblk = (n1 + BSIZE - 1) / BSIZE + 1;
+            nblk = UMIN(nblk + 1 + 3 + 2, log_maxblocks());
+
+            begin_ntrans(nblk);
             ilock(f->ip);
 
             if ((r = writei(f->ip, addr + i, f->off, n1)) > 0) {
@@ -168,7 +180,7 @@ int filewrite (struct file *f, char *addr, int n)
             }
 
             iunlock(f->ip);
-            commit_trans();
+            commit_ntrans(nblk);
 
             if (r < 0) {
                 break;
@@ -14,17 +14,33 @@ struct inode {
     uint    dev;        // Device number
     uint    inum;       // Inode number
     int     ref;        // Reference count
-    int     flags;      // I_BUSY, I_VALID
+    int     flags;      // I_BUSY, I_VALID, I_PCACHE
 
     short   type;       // copy of disk inode
     short   major;
     short   minor;
     short   nlink;
     uint    size;
-    uint    addrs[NDIRECT+1];
+    uint    addrs[NDIRECT+2];
+
+    uint    bm_start;   // bmap cache: file block of bm_addr[0]
+    uint    bm_n;       // valid entries in bm_addr, 0 if empty
+    uint    bm_addr[NBMAP]; // disk blocks, copied from an indirect block
+    uint    lastblk;    // disk block last allocated to the file, 0 if none
+
+    uint    ra_next;    // block a sequential reader would read next
+    uint    ra_ahead;   // blocks below this have been read ahead
+    uint    ra_win;     // read-ahead window (blocks), 0 if not sequential
+
+    struct dirindex *dindex;    // name index of a directory, or 0 (fs.c)
+
+    struct inode *hnext;    // icache hash chain
+    struct inode *prev;     // icache LRU list, while ref is 0
+    struct inode *next;
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
+#define I_PCACHE 0x4    // the page cache may hold pages of this file
 
 // table mapping major device number to
 // device functions
@@ -22,14 +22,52 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc (struct inode*);
+static void dirinit (void);
+static void di_free (struct inode*);
+static void dcache_init (void);
+static void dcache_purge (uint, uint);
+static void dcache_inval (uint, uint, char*);
+
+// There should be one super block per disk device, but we run
+// with only one device.
+static struct superblock sb;
+
+// Until fsinit has read the block size from the super block, blocks
+// are sectors.
+uint fsbsize = SECTSIZE;
+
+// Read the super block of dev, the root device, to learn the block
+// size. This runs before the buffer cache is set up, since the
+// buffers are sized to hold a block, so it reads the sector of the
+// super block with a buffer of its own.
+void fsinit (int dev)
+{
+    static uchar sect[SECTSIZE];
+    struct buf b;
+
+    memset(&b, 0, sizeof(b));
+    b.dev = dev;
+    b.blockno = SBSECT;
+    b.flags = B_BUSY;
+    b.data = sect;
+    iderw(&b);
+
+    memmove(&sb, sect, sizeof(sb));
+
+    if ((sb.bsize < MINBSIZE) || (sb.bsize > MAXBSIZE) || (sb.bsize & (sb.bsize - 1))) {
+        panic("fsinit: bad block size");
+    }
+
+    fsbsize = sb.bsize;
+}
 
 // Read the super block.
 void readsb (int dev, struct superblock *sb)
 {
     struct buf *bp;
 
-    bp = bread(dev, 1);
-    memmove(sb, bp->data, sizeof(*sb));
+    bp = bread(dev, SBBLOCK);
+    memmove(sb, bp->data + SBOFF, sizeof(*sb));
     brelse(bp);
 }
 
@@ -45,47 +83,137 @@ static void bzero (int dev, int bno)
 }
 
 // Blocks.
-
-// Allocate a zeroed disk block.
-static uint balloc (uint dev)
+//
+// The free bitmap is also kept in memory (fmap), as words in pages,
+// read in by fsmount once the log has been recovered. balloc looks
+// for a free block there, a word of 32 blocks at a time, starting
+// from a goal: the block after the one the file got last, so that
+// appending to a file lays it out contiguously. The on-disk bitmap
+// is then updated through the log, as before. A block is marked in
+// use in memory before on disk, and free on disk before in memory,
+// so the two never hand out the same block.
+
+#define FM_WPP      (PTE_SZ / sizeof(uint))     // words in a page of fmap
+#define FM_WORD(w)  (fmap.page[(w) / FM_WPP][(w) % FM_WPP])
+
+static struct {
+    struct spinlock lock;
+    uint    **page;     // pages of the bitmap, 1 bits for blocks in use
+    uint    nword;
+    uint    nfree;      // free blocks
+    uint    rotor;      // goal when the caller has none
+} fmap;
+
+// Read the free bitmap of dev into memory. Bits past the end of
+// the file system are marked in use.
+static void fmap_load (int dev)
 {
-    int b, bi, m;
     struct buf *bp;
-    struct superblock sb;
+    uint nbytes, b, w;
+    char *mem;
 
-    bp = 0;
-    readsb(dev, &sb);
+    initlock(&fmap.lock, "fmap");
 
-    for (b = 0; b < sb.size; b += BPB) {
-        bp = bread(dev, BBLOCK(b, sb.ninodes));
+    nbytes = (sb.size / BPB + 1) * BSIZE;
+    fmap.nword = nbytes / sizeof(uint);
 
-        for (bi = 0; bi < BPB && b + bi < sb.size; bi++) {
-            m = 1 << (bi % 8);
+    if ((nbytes > FM_WPP * PTE_SZ) || ((fmap.page = alloc_page()) == 0)) {
+        panic("fmap_load: bitmap too big");
+    }
 
-            if ((bp->data[bi / 8] & m) == 0) {  // Is block free?
-                bp->data[bi / 8] |= m;  // Mark block in use.
-                log_write(bp);
-                brelse(bp);
-                bzero(dev, b + bi);
-                return b + bi;
-            }
+    for (b = 0; b < nbytes; b += PTE_SZ) {
+        if ((mem = alloc_page()) == 0) {
+            panic("fmap_load: no memory");
         }
 
+        fmap.page[b / PTE_SZ] = (uint*) mem;
+    }
+
+    // a bitmap block never straddles pages, both are powers of two
+    for (b = 0; b < sb.size; b += BPB) {
+        bp = bread(dev, BBLOCK(b, sb));
+        memmove(&FM_WORD(b / 32), bp->data, BSIZE);
         brelse(bp);
     }
 
-    panic("balloc: out of blocks");
+    for (b = sb.size; b < fmap.nword * 32; b++) {
+        FM_WORD(b / 32) |= 1U << (b % 32);
+    }
+
+    for (w = 0; w < fmap.nword; w++) {
+        fmap.nfree += 32 - __builtin_popcount(FM_WORD(w));
+    }
+}
+
+// Find a free block, at goal if possible, otherwise the first one
+// after it, wrapping around. Caller holds fmap.lock.
+static uint fmap_find (uint goal)
+{
+    uint w, m, i;
+
+    if (fmap.nfree == 0) {
+        return 0;
+    }
+
+    if ((goal == 0) || (goal >= sb.size)) {
+        goal = (fmap.rotor < sb.size) ? fmap.rotor : 0;
+    }
+
+    if (!(FM_WORD(goal / 32) & (1U << (goal % 32)))) {
+        return goal;
+    }
+
+    w = goal / 32;
+
+    // the bits below goal in its word are looked at last, on wrapping
+    for (i = 0; i <= fmap.nword; i++, w = (w + 1) % fmap.nword) {
+        m = FM_WORD(w);
+
+        if (i == 0) {
+            m |= (1U << (goal % 32)) - 1;
+        }
+
+        if (m != 0xFFFFFFFF) {
+            return w * 32 + __builtin_ctz(~m);
+        }
+    }
+
+    return 0;
+}
+
+// Allocate a zeroed disk block, near goal (0 for anywhere).
+static uint balloc (uint dev, uint goal)
+{
+    struct buf *bp;
+    uint b;
+
+    acquire(&fmap.lock);
+
+    if ((b = fmap_find(goal)) == 0) {
+        panic("balloc: out of blocks");
+    }
+
+    FM_WORD(b / 32) |= 1U << (b % 32);
+    fmap.nfree--;
+    fmap.rotor = b + 1;
+    release(&fmap.lock);
+
+    bp = bread(dev, BBLOCK(b, sb));
+    bp->data[(b % BPB) / 8] |= 1 << (b % 8);  // Mark block in use.
+    log_write(bp);
+    brelse(bp);
+
+    bzero(dev, b);
+    return b;
 }
 
 // Free a disk block.
 static void bfree (int dev, uint b)
 {
     struct buf *bp;
-    struct superblock sb;
     int bi, m;
 
-    readsb(dev, &sb);
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
+    bp = bread(dev, BBLOCK(b, sb));
     bi = b % BPB;
     m = 1 << (bi % 8);
 
@@ -96,6 +224,19 @@ static void bfree (int dev, uint b)
     bp->data[bi / 8] &= ~m;
     log_write(bp);
     brelse(bp);
+
+    acquire(&fmap.lock);
+    FM_WORD(b / 32) &= ~(1U << (b % 32));
+    fmap.nfree++;
+    release(&fmap.lock);
+}
+
+// Allocate a block for the file ip, after the one it got last
+// (seeded by writei with the last block of a file read from disk).
+static uint fballoc (struct inode *ip)
+{
+    ip->lastblk = balloc(ip->dev, ip->lastblk ? ip->lastblk + 1 : 0);
+    return ip->lastblk;
 }
 
 // Inodes.
@@ -123,18 +264,22 @@ static void bfree (int dev, uint b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files, current
+//   directories and mapped programs). iget() to find or
 //   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+//   to decrement ref. Entries are allocated from a slab
+//   cache and found through a hash table. An entry whose
+//   ref falls to zero stays cached, on an LRU list, so
+//   reopening the file finds it valid. Once NICACHE
+//   entries are unreferenced, or memory runs out, iget()
+//   recycles the least recently used one.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when the I_VALID bit
 //   is set in ip->flags. ilock() reads the inode from
 //   the disk and sets I_VALID, while iput() clears
-//   I_VALID if ip->ref has fallen to zero.
+//   I_VALID when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -160,46 +305,144 @@ static void bfree (int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+#define IHASH(dev, inum)    (((inum) ^ ((dev) << 12)) & (NIHASH - 1))
+
 struct {
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct kmem_cache *cache;
+    struct inode *hash[NIHASH]; // cached inodes, through hnext
+    struct inode lru;           // unreferenced inodes, lru.next is
+                                // the most recently used
+    uint nlru;                  // inodes on the lru list
+
+    uint hits;
+    uint misses;
+    uint recycled;
 } icache;
 
 void iinit (void)
 {
     initlock(&icache.lock, "icache");
+    icache.lru.prev = icache.lru.next = &icache.lru;
+    icache.cache = kmem_cache_create("inode", sizeof(struct inode), 0);
+    dirinit();
+    dcache_init();
 }
 
 static struct inode* iget (uint dev, uint inum);
 
+// Inodes free on disk, a bit for each, kept so that ialloc does
+// not have to read the inode blocks looking for one. Built by
+// fsmount, cleared by ialloc and set again by iput when it frees
+// an inode. ifirst is a hint: no inode below it is free.
+static struct {
+    struct spinlock lock;
+    uint    *bits;      // 1 bits for free inodes
+    uint    nword;
+    uint    nfree;
+    uint    ifirst;
+} imap;
+
+// Find the free inodes of dev by reading its inode blocks, once.
+static void imap_load (int dev)
+{
+    struct buf *bp;
+    struct dinode *dip;
+    uint inum;
+
+    initlock(&imap.lock, "imap");
+
+    imap.nword = sb.ninodes / 32 + 1;
+
+    if ((imap.nword > PTE_SZ / sizeof(uint)) || ((imap.bits = alloc_page()) == 0)) {
+        panic("imap_load: too many inodes");
+    }
+
+    memset(imap.bits, 0, PTE_SZ);
+    imap.ifirst = sb.ninodes;
+
+    // inode 0 is never used, a directory entry of 0 is an empty one
+    for (inum = 1; inum < sb.ninodes; inum++) {
+        bp = bread(dev, IBLOCK(inum, sb));
+        dip = (struct dinode*) bp->data + inum % IPB;
+
+        if (dip->type == 0) {
+            imap.bits[inum / 32] |= 1U << (inum % 32);
+            imap.nfree++;
+
+            if (inum < imap.ifirst) {
+                imap.ifirst = inum;
+            }
+        }
+
+        brelse(bp);
+    }
+}
+
+// Mark inum free in imap, once it is free on disk.
+static void imap_free (uint inum)
+{
+    acquire(&imap.lock);
+    imap.bits[inum / 32] |= 1U << (inum % 32);
+    imap.nfree++;
+
+    if (inum < imap.ifirst) {
+        imap.ifirst = inum;
+    }
+
+    release(&imap.lock);
+}
+
+// Set up the in-memory state of the file system on dev that comes
+// from its contents, once the log has been recovered.
+void fsmount (int dev)
+{
+    fmap_load(dev);
+    imap_load(dev);
+}
+
 //PAGEBREAK!
 // Allocate a new inode with the given type on device dev.
 // A free inode has a type of zero.
 struct inode* ialloc (uint dev, short type)
 {
-    int inum;
+    uint inum, w, m;
     struct buf *bp;
     struct dinode *dip;
-    struct superblock sb;
 
-    readsb(dev, &sb);
+    acquire(&imap.lock);
 
-    for (inum = 1; inum < sb.ninodes; inum++) {
-        bp = bread(dev, IBLOCK(inum));
-        dip = (struct dinode*) bp->data + inum % IPB;
+    inum = 0;
 
-        if (dip->type == 0) {  // a free inode
-            memset(dip, 0, sizeof(*dip));
-            dip->type = type;
-            log_write(bp);   // mark it allocated on the disk
-            brelse(bp);
-            return iget(dev, inum);
+    for (w = imap.ifirst / 32; (imap.nfree > 0) && (w < imap.nword); w++) {
+        if ((m = imap.bits[w]) != 0) {
+            inum = w * 32 + __builtin_ctz(m);
+            break;
         }
+    }
 
-        brelse(bp);
+    if (inum == 0 || inum >= sb.ninodes) {
+        panic("ialloc: no inodes");
+    }
+
+    imap.bits[inum / 32] &= ~(1U << (inum % 32));
+    imap.nfree--;
+    imap.ifirst = inum + 1;
+    release(&imap.lock);
+
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*) bp->data + inum % IPB;
+
+    if (dip->type != 0) {
+        panic("ialloc: free inode in use");
     }
 
-    panic("ialloc: no inodes");
+    memset(dip, 0, sizeof(*dip));
+    dip->type = type;
+    log_write(bp);   // mark it allocated on the disk
+    brelse(bp);
+
+    return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -208,7 +451,7 @@ void iupdate (struct inode *ip)
     struct buf *bp;
     struct dinode *dip;
 
-    bp = bread(ip->dev, IBLOCK(ip->inum));
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
 
     dip = (struct dinode*) bp->data + ip->inum % IPB;
     dip->type = ip->type;
@@ -222,40 +465,86 @@ void iupdate (struct inode *ip)
     brelse(bp);
 }
 
+static void lru_remove (struct inode *ip)
+{
+    ip->next->prev = ip->prev;
+    ip->prev->next = ip->next;
+    ip->prev = ip->next = 0;
+    icache.nlru--;
+}
+
+// Take the least recently used unreferenced inode out of the cache,
+// for reuse, or return 0 if every inode is in use. Caller holds
+// icache.lock.
+static struct inode* irecycle (void)
+{
+    struct inode *ip, **pp;
+
+    if ((ip = icache.lru.prev) == &icache.lru) {
+        return 0;
+    }
+
+    lru_remove(ip);
+
+    for (pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext) {
+    }
+
+    *pp = ip->hnext;
+
+    // the page cache is keyed by inode number and forgets
+    // the pages of files that are not in the inode cache.
+    if (ip->flags & I_PCACHE) {
+        pcache_inval(ip);
+    }
+
+    di_free(ip);
+    icache.recycled++;
+    return ip;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode* iget (uint dev, uint inum)
 {
-    struct inode *ip, *empty;
+    struct inode *ip;
 
     acquire(&icache.lock);
 
     // Is the inode already cached?
-    empty = 0;
+    for (ip = icache.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext) {
+        if (ip->dev == dev && ip->inum == inum) {
+            if (ip->ref++ == 0) {
+                lru_remove(ip);
+            }
 
-    for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
-            ip->ref++;
+            icache.hits++;
             release(&icache.lock);
             return ip;
         }
+    }
 
-        if (empty == 0 && ip->ref == 0) {   // Remember empty slot.
-            empty = ip;
-        }
+    icache.misses++;
+
+    // Allocate a new inode cache entry, or recycle an unreferenced
+    // one if there are plenty of them or no memory.
+    ip = 0;
+
+    if (icache.nlru >= NICACHE) {
+        ip = irecycle();
     }
 
-    // Recycle an inode cache entry.
-    if (empty == 0) {
+    if ((ip == 0) && ((ip = kmem_cache_alloc(icache.cache)) == 0)
+            && ((ip = irecycle()) == 0)) {
         panic("iget: no inodes");
     }
 
-    ip = empty;
+    memset(ip, 0, sizeof(*ip));
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
-    ip->flags = 0;
+    ip->hnext = icache.hash[IHASH(dev, inum)];
+    icache.hash[IHASH(dev, inum)] = ip;
     release(&icache.lock);
 
     return ip;
@@ -291,7 +580,7 @@ void ilock (struct inode *ip)
     release(&icache.lock);
 
     if (!(ip->flags & I_VALID)) {
-        bp = bread(ip->dev, IBLOCK(ip->inum));
+        bp = bread(ip->dev, IBLOCK(ip->inum, sb));
 
         dip = (struct dinode*) bp->data + ip->inum % IPB;
         ip->type = dip->type;
@@ -324,8 +613,8 @@ void iunlock (struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry
+// can be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 void iput (struct inode *ip)
@@ -340,19 +629,42 @@ void iput (struct inode *ip)
 
         ip->flags |= I_BUSY;
         release(&icache.lock);
+
+        // forget the names cached in a removed directory, before
+        // its inode number can be reused
+        if (ip->type == T_DIR) {
+            dcache_purge(ip->dev, ip->inum);
+        }
+
         itrunc(ip);
+        di_free(ip);
         ip->type = 0;
         iupdate(ip);
+        imap_free(ip->inum);
 
         acquire(&icache.lock);
         ip->flags = 0;
         wakeup(ip);
     }
 
-    ip->ref--;
+    if (--ip->ref == 0) {
+        ip->next = icache.lru.next;
+        ip->prev = &icache.lru;
+        icache.lru.next->prev = ip;
+        icache.lru.next = ip;
+        icache.nlru++;
+    }
+
     release(&icache.lock);
 }
 
+// Print inode cache statistics to the console.
+void istat (void)
+{
+    cprintf("icache: %d unreferenced, %d hits, %d misses, %d recycled\n",
+            icache.nlru, icache.hits, icache.misses, icache.recycled);
+}
+
 // Common idiom: unlock, then put.
 void iunlockput (struct inode *ip)
 {
@@ -366,46 +678,112 @@ void iunlockput (struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the blocks listed in the double
+// indirect block ip->addrs[NDIRECT+1].
+//
+// Reading an indirect block for every data block would double
+// the cost of sequential access. Instead, bmap copies the NBMAP
+// entries around the one it looks up into the inode (bm_addr),
+// and later lookups in that range are answered from there.
+
+#define NOBMAP  0xFFFFFFFF  // indirect() should not fill the bmap cache
+
+// Return entry idx of the indirect block blk of ip, allocating
+// the block it refers to if there is none. If bn, the file block
+// the entry is for, is not NOBMAP, fill the bmap cache with the
+// entries around it.
+static uint indirect (struct inode *ip, uint blk, uint idx, uint bn)
+{
+    uint addr, first, *a;
+    struct buf *bp;
+
+    bp = bread(ip->dev, blk);
+    a = (uint*) bp->data;
+
+    if ((addr = a[idx]) == 0) {
+        a[idx] = addr = fballoc(ip);
+        log_write(bp);
+    }
+
+    if (bn != NOBMAP) {
+        first = idx & ~(NBMAP - 1);
+        memmove(ip->bm_addr, a + first, sizeof(ip->bm_addr));
+        ip->bm_start = bn - (idx - first);
+        ip->bm_n = NBMAP;
+    }
+
+    brelse(bp);
+    return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint bmap (struct inode *ip, uint bn)
 {
-    uint addr, *a;
-    struct buf *bp;
+    uint addr, n;
 
     if (bn < NDIRECT) {
         if ((addr = ip->addrs[bn]) == 0) {
-            ip->addrs[bn] = addr = balloc(ip->dev);
+            ip->addrs[bn] = addr = fballoc(ip);
         }
 
         return addr;
     }
 
-    bn -= NDIRECT;
+    // a block the cache has seen allocated
+    if ((bn - ip->bm_start < ip->bm_n) && ((addr = ip->bm_addr[bn - ip->bm_start]) != 0)) {
+        return addr;
+    }
+
+    n = bn - NDIRECT;
 
-    if (bn < NINDIRECT) {
+    if (n < NINDIRECT) {
         // Load indirect block, allocating if necessary.
         if ((addr = ip->addrs[NDIRECT]) == 0) {
-            ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+            ip->addrs[NDIRECT] = addr = fballoc(ip);
         }
 
-        bp = bread(ip->dev, addr);
-        a = (uint*) bp->data;
+        return indirect(ip, addr, n, bn);
+    }
+
+    n -= NINDIRECT;
 
-        if ((addr = a[bn]) == 0) {
-            a[bn] = addr = balloc(ip->dev);
-            log_write(bp);
+    if (n < NDINDIRECT) {
+        if ((addr = ip->addrs[NDIRECT + 1]) == 0) {
+            ip->addrs[NDIRECT + 1] = addr = fballoc(ip);
         }
 
-        brelse(bp);
-        return addr;
+        addr = indirect(ip, addr, n / NINDIRECT, NOBMAP);
+        return indirect(ip, addr, n % NINDIRECT, bn);
     }
 
     panic("bmap: out of range");
 }
 
+// Free the blocks listed in the indirect block blk, and blk itself.
+// If depth is 1, the listed blocks are indirect blocks themselves.
+static void ifree (uint dev, uint blk, int depth)
+{
+    struct buf *bp;
+    uint *a;
+    int j;
+
+    bp = bread(dev, blk);
+    a = (uint*) bp->data;
+
+    for (j = 0; j < NINDIRECT; j++) {
+        if (a[j] && depth > 0) {
+            ifree(dev, a[j], depth - 1);
+        } else if (a[j]) {
+            bfree(dev, a[j]);
+        }
+    }
+
+    brelse(bp);
+    bfree(dev, blk);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -413,9 +791,11 @@ static uint bmap (struct inode *ip, uint bn)
 // not an open file or current directory).
 static void itrunc (struct inode *ip)
 {
-    int i, j;
-    struct buf *bp;
-    uint *a;
+    int i;
+
+    if (ip->flags & I_PCACHE) {
+        pcache_inval(ip);
+    }
 
     for (i = 0; i < NDIRECT; i++) {
         if (ip->addrs[i]) {
@@ -425,20 +805,17 @@ static void itrunc (struct inode *ip)
     }
 
     if (ip->addrs[NDIRECT]) {
-        bp = bread(ip->dev, ip->addrs[NDIRECT]);
-        a = (uint*) bp->data;
-
-        for (j = 0; j < NINDIRECT; j++) {
-            if (a[j]) {
-                bfree(ip->dev, a[j]);
-            }
-        }
-
-        brelse(bp);
-        bfree(ip->dev, ip->addrs[NDIRECT]);
+        ifree(ip->dev, ip->addrs[NDIRECT], 0);
         ip->addrs[NDIRECT] = 0;
     }
 
+    if (ip->addrs[NDIRECT + 1]) {
+        ifree(ip->dev, ip->addrs[NDIRECT + 1], 1);
+        ip->addrs[NDIRECT + 1] = 0;
+    }
+
+    ip->bm_n = 0;
+    ip->lastblk = 0;
     ip->size = 0;
     iupdate(ip);
 }
@@ -451,13 +828,48 @@ void stati (struct inode *ip, struct stat *st)
     st->type = ip->type;
     st->nlink = ip->nlink;
     st->size = ip->size;
+    st->blksize = BSIZE;
 }
 
 //PAGEBREAK!
+// Sequential read-ahead. A read of blocks [bn, end) that starts at the
+// beginning of the file or where the previous read left off (or
+// re-reads its last, partially consumed block) counts as sequential.
+// Each sequential read doubles the window, up to RA_MAXWIN blocks, and
+// the blocks in the window past end that have not been read ahead yet
+// are pulled into the buffer cache. A random access closes the window.
+static void readahead (struct inode *ip, uint bn, uint end)
+{
+    uint b, last;
+
+    if (bn == 0 || bn == ip->ra_next || bn + 1 == ip->ra_next) {
+        ip->ra_win = (ip->ra_win == 0) ? 2 : min(ip->ra_win * 2, RA_MAXWIN);
+    } else {
+        ip->ra_win = 0;
+        ip->ra_ahead = 0;
+    }
+
+    ip->ra_next = end;
+
+    if (ip->ra_win == 0) {
+        return;
+    }
+
+    last = min(end + ip->ra_win, (ip->size + BSIZE - 1) / BSIZE);
+
+    for (b = (ip->ra_ahead > end) ? ip->ra_ahead : end; b < last; b++) {
+        breadahead(ip->dev, bmap(ip, b));
+    }
+
+    if (last > ip->ra_ahead) {
+        ip->ra_ahead = last;
+    }
+}
+
 // Read data from inode.
 int readi (struct inode *ip, char *dst, uint off, uint n)
 {
-    uint tot, m;
+    uint tot, m, start;
     struct buf *bp;
 
     if (ip->type == T_DEV) {
@@ -476,6 +888,8 @@ int readi (struct inode *ip, char *dst, uint off, uint n)
         n = ip->size - off;
     }
 
+    start = off;
+
     for (tot = 0; tot < n; tot += m, off += m, dst += m) {
         bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off%BSIZE);
@@ -483,6 +897,10 @@ int readi (struct inode *ip, char *dst, uint off, uint n)
         brelse(bp);
     }
 
+    if (n > 0) {
+        readahead(ip, start / BSIZE, (off + BSIZE - 1) / BSIZE);
+    }
+
     return n;
 }
 
@@ -505,10 +923,19 @@ int writei (struct inode *ip, char *src, uint off, uint n)
         return -1;
     }
 
-    if (off + n > MAXFILE * BSIZE) {
+    if ((n > 0) && ((off + n - 1) / BSIZE >= MAXFILE)) {
         return -1;
     }
 
+    if (ip->flags & I_PCACHE) {
+        pcache_update(ip, src, off, n);
+    }
+
+    // a file read in from the disk grows on after its last block
+    if ((ip->lastblk == 0) && (ip->size > 0)) {
+        ip->lastblk = bmap(ip, (ip->size - 1) / BSIZE);
+    }
+
     for (tot = 0; tot < n; tot += m, off += m, src += m) {
         bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off%BSIZE);
@@ -527,70 +954,341 @@ int writei (struct inode *ip, char *src, uint off, uint n)
 
 //PAGEBREAK!
 // Directories
+//
+// On disk, a directory is a linear array of dirents. Scanning it
+// for every lookup, and again for every create (once to check for
+// duplicates and once for a free slot), is quadratic in the size
+// of the directory. So the first lookup in a directory builds an
+// index of it in memory, attached to the inode: a hash table from
+// names to the offsets of their entries, plus a list of the free
+// slots. The index is kept up to date by dirlink and dirunlink,
+// the only writers of directories, and lives as long as the inode
+// stays in the inode cache. Without memory for the index, the
+// directory is simply scanned, as before.
+
+#define DI_NBUCKET  64      // buckets of a new index
+#define DI_MAXBUCKET (PTE_SZ / sizeof(struct dent*))  // a page of buckets
+
+// An entry of a directory index: a name, or a free slot if inum is 0
+struct dent {
+    char            name[DIRSIZ];
+    ushort          inum;
+    uint            off;        // offset of the dirent in the directory
+    struct dent*    next;       // hash chain, or free list
+};
+
+struct dirindex {
+    uint            n;          // names in the index
+    uint            nbucket;    // power of two
+    struct dent**   bucket;     // small[], or a page
+    struct dent*    free;       // free slots
+    struct dent*    small[DI_NBUCKET];
+};
+
+static struct {
+    struct kmem_cache *index;   // struct dirindex
+    struct kmem_cache *dent;    // struct dent
+} dicache;
+
+static void dirinit (void)
+{
+    dicache.index = kmem_cache_create("dirindex", sizeof(struct dirindex), 0);
+    dicache.dent = kmem_cache_create("dent", sizeof(struct dent), 0);
+}
 
 int namecmp (const char *s, const char *t)
 {
     return strncmp(s, t, DIRSIZ);
 }
 
+// FNV-1a hash of a name of up to DIRSIZ bytes
+static uint namehash (const char *name)
+{
+    uint h;
+    int i;
+
+    h = 2166136261U;
+
+    for (i = 0; i < DIRSIZ && name[i] != 0; i++) {
+        h = (h ^ (uchar) name[i]) * 16777619U;
+    }
+
+    return h;
+}
+
+static void di_free (struct inode *dp)
+{
+    struct dirindex *di;
+    struct dent *d;
+    uint i;
+
+    if ((di = dp->dindex) == 0) {
+        return;
+    }
+
+    for (i = 0; i < di->nbucket; i++) {
+        while ((d = di->bucket[i]) != 0) {
+            di->bucket[i] = d->next;
+            kmem_cache_free(dicache.dent, d);
+        }
+    }
+
+    while ((d = di->free) != 0) {
+        di->free = d->next;
+        kmem_cache_free(dicache.dent, d);
+    }
+
+    if (di->bucket != di->small) {
+        free_page(di->bucket);
+    }
+
+    kmem_cache_free(dicache.index, di);
+    dp->dindex = 0;
+}
+
+// Move the entries of di to a page of buckets once the chains grow
+// long. If there is no page, keep the chains as they are.
+static void di_grow (struct dirindex *di)
+{
+    struct dent **nb, *d;
+    uint i, h;
+
+    if ((di->bucket != di->small) || (di->n < 2 * DI_NBUCKET)) {
+        return;
+    }
+
+    if ((nb = alloc_page()) == 0) {
+        return;
+    }
+
+    memset(nb, 0, PTE_SZ);
+
+    for (i = 0; i < DI_NBUCKET; i++) {
+        while ((d = di->small[i]) != 0) {
+            di->small[i] = d->next;
+            h = namehash(d->name) & (DI_MAXBUCKET - 1);
+            d->next = nb[h];
+            nb[h] = d;
+        }
+    }
+
+    di->bucket = nb;
+    di->nbucket = DI_MAXBUCKET;
+}
+
+// Record the entry (name, inum) at off in the index of dp, or a free
+// slot if inum is 0. Without memory, the index is dropped.
+static void di_add (struct inode *dp, char *name, uint inum, uint off)
+{
+    struct dirindex *di;
+    struct dent *d, **pd;
+
+    di = dp->dindex;
+
+    if ((d = kmem_cache_alloc(dicache.dent)) == 0) {
+        di_free(dp);
+        return;
+    }
+
+    strncpy(d->name, name, DIRSIZ);
+    d->inum = inum;
+    d->off = off;
+
+    if (inum == 0) {
+        pd = &di->free;
+    } else {
+        pd = &di->bucket[namehash(name) & (di->nbucket - 1)];
+        di->n++;
+    }
+
+    d->next = *pd;
+    *pd = d;
+
+    if (inum != 0) {
+        di_grow(di);
+    }
+}
+
+// Return the link to the index entry for name in dp, or 0.
+static struct dent** di_find (struct dirindex *di, char *name)
+{
+    struct dent **pd;
+
+    for (pd = &di->bucket[namehash(name) & (di->nbucket - 1)]; *pd != 0; pd = &(*pd)->next) {
+        if (namecmp(name, (*pd)->name) == 0) {
+            return pd;
+        }
+    }
+
+    return 0;
+}
+
+// Call fn(dp, de, off) for each dirent of the directory dp, a
+// block at a time, until it returns non-zero. Return what it
+// returned, or 0.
+static int dirscan (struct inode *dp, int (*fn)(struct inode*, struct dirent*, uint, void*),
+                    void *arg)
+{
+    struct buf *bp;
+    struct dirent *de;
+    uint off, end;
+    int r;
+
+    for (off = 0; off < dp->size; off = end) {
+        end = min(dp->size, (off / BSIZE + 1) * BSIZE);
+        bp = bread(dp->dev, bmap(dp, off / BSIZE));
+
+        for (; off + sizeof(*de) <= end; off += sizeof(*de)) {
+            de = (struct dirent*) (bp->data + off % BSIZE);
+
+            if ((r = fn(dp, de, off, arg)) != 0) {
+                brelse(bp);
+                return r;
+            }
+        }
+
+        brelse(bp);
+    }
+
+    return 0;
+}
+
+static int di_fill (struct inode *dp, struct dirent *de, uint off, void *arg)
+{
+    di_add(dp, de->name, de->inum, off);
+
+    // give up if di_add has run out of memory
+    return dp->dindex == 0;
+}
+
+// Return the index of the directory dp, building it if need be,
+// or 0 if there is no memory for it. Caller holds dp locked.
+static struct dirindex* dirindex (struct inode *dp)
+{
+    struct dirindex *di;
+
+    if (dp->dindex != 0) {
+        return dp->dindex;
+    }
+
+    if ((di = kmem_cache_alloc(dicache.index)) == 0) {
+        return 0;
+    }
+
+    memset(di, 0, sizeof(*di));
+    di->nbucket = DI_NBUCKET;
+    di->bucket = di->small;
+    dp->dindex = di;
+
+    dirscan(dp, di_fill, 0);
+    return dp->dindex;
+}
+
+struct dirmatch {
+    char    *name;
+    uint    off;        // offset of the match, or of a free slot
+    uint    inum;       // inum of the match, or 0
+    int     free;       // a free slot was seen
+};
+
+// dirscan callback to find an entry by name, and a free slot
+static int di_match (struct inode *dp, struct dirent *de, uint off, void *arg)
+{
+    struct dirmatch *m;
+
+    m = arg;
+
+    if (de->inum == 0) {
+        if (!m->free) {
+            m->free = 1;
+            m->off = off;
+        }
+
+        return 0;
+    }
+
+    if (namecmp(m->name, de->name) == 0) {
+        m->inum = de->inum;
+        m->off = off;
+        return 1;
+    }
+
+    return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode* dirlookup (struct inode *dp, char *name, uint *poff)
 {
-    uint off, inum;
-    struct dirent de;
+    struct dirindex *di;
+    struct dirmatch m;
+    struct dent **pd;
 
     if (dp->type != T_DIR) {
         panic("dirlookup not DIR");
     }
 
-    for (off = 0; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, (char*) &de, off, sizeof(de)) != sizeof(de)) {
-            panic("dirlink read");
+    if ((di = dirindex(dp)) != 0) {
+        if ((pd = di_find(di, name)) == 0) {
+            return 0;
         }
 
-        if (de.inum == 0) {
-            continue;
-        }
+        m.inum = (*pd)->inum;
+        m.off = (*pd)->off;
 
-        if (namecmp(name, de.name) == 0) {
-            // entry matches path element
-            if (poff) {
-                *poff = off;
-            }
+    } else {
+        memset(&m, 0, sizeof(m));
+        m.name = name;
 
-            inum = de.inum;
-            return iget(dp->dev, inum);
+        if (dirscan(dp, di_match, &m) == 0) {
+            return 0;
         }
     }
 
-    return 0;
+    // entry matches path element
+    if (poff) {
+        *poff = m.off;
+    }
+
+    return iget(dp->dev, m.inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int dirlink (struct inode *dp, char *name, uint inum)
 {
-    int off;
+    struct dirindex *di;
+    struct dirmatch m;
     struct dirent de;
-    struct inode *ip;
+    struct dent *d;
+    uint off;
 
-    // Check that name is not present.
-    if ((ip = dirlookup(dp, name, 0)) != 0) {
-        iput(ip);
-        return -1;
-    }
+    if ((di = dirindex(dp)) != 0) {
+        // Check that name is not present.
+        if (di_find(di, name) != 0) {
+            return -1;
+        }
 
-    // Look for an empty dirent.
-    for (off = 0; off < dp->size; off += sizeof(de)) {
-        if (readi(dp, (char*) &de, off, sizeof(de)) != sizeof(de)) {
-            panic("dirlink read");
+        // Take a free slot, or append.
+        off = dp->size;
+
+        if ((d = di->free) != 0) {
+            di->free = d->next;
+            off = d->off;
+            kmem_cache_free(dicache.dent, d);
         }
 
-        if (de.inum == 0) {
-            break;
+    } else {
+        memset(&m, 0, sizeof(m));
+        m.name = name;
+
+        if (dirscan(dp, di_match, &m) != 0) {
+            return -1;
         }
+
+        off = m.free ? m.off : dp->size;
     }
 
+    memset(&de, 0, sizeof(de));
     strncpy(de.name, name, DIRSIZ);
     de.inum = inum;
 
@@ -598,9 +1296,240 @@ int dirlink (struct inode *dp, char *name, uint inum)
         panic("dirlink");
     }
 
+    dcache_inval(dp->dev, dp->inum, name);
+
+    if (dp->dindex != 0) {
+        di_add(dp, name, inum, off);
+    }
+
     return 0;
 }
 
+// Remove the entry for name, at offset off, from the directory dp.
+void dirunlink (struct inode *dp, char *name, uint off)
+{
+    struct dent **pd, *d;
+    struct dirent de;
+
+    memset(&de, 0, sizeof(de));
+
+    if (writei(dp, (char*) &de, off, sizeof(de)) != sizeof(de)) {
+        panic("dirunlink: writei");
+    }
+
+    dcache_inval(dp->dev, dp->inum, name);
+
+    if ((dp->dindex != 0) && ((pd = di_find(dp->dindex, name)) != 0)) {
+        d = *pd;
+        *pd = d->next;
+        dp->dindex->n--;
+
+        // the entry becomes a free slot
+        d->inum = 0;
+        d->next = dp->dindex->free;
+        dp->dindex->free = d;
+    }
+}
+
+//PAGEBREAK!
+// Dentry cache
+//
+// namex caches the results of looking up a name in a directory,
+// keyed by (device, directory inum, name), including the names
+// that are not there (negative entries, inum 0). A hit resolves a
+// path element without locking the directory. An entry goes away
+// when dirlink or dirunlink changes the name, or when its directory
+// is freed, so the directory of a cached entry is still a directory
+// that holds (or lacks) the name. The least recently used entry is
+// recycled for a new one.
+
+#define NDHASH  64  // buckets of the dentry cache
+
+struct dentry {
+    uint            dev;        // 0 if the entry is unused
+    uint            dinum;      // directory
+    char            name[DIRSIZ];
+    uint            inum;       // inode of the name, 0 if not present
+    struct dentry*  hnext;      // hash chain
+    struct dentry*  prev;       // LRU list
+    struct dentry*  next;
+};
+
+static struct {
+    struct spinlock lock;
+    struct dentry   entry[NDENTRY];
+    struct dentry*  hash[NDHASH];
+    struct dentry   head;       // LRU list, head.next is most recently used
+
+    uint            hits;
+    uint            neghits;    // hits on negative entries
+    uint            misses;
+} dcache;
+
+static uint dhash (uint dev, uint dinum, char *name)
+{
+    return (namehash(name) ^ dinum ^ (dev << 16)) & (NDHASH - 1);
+}
+
+static void dcache_init (void)
+{
+    struct dentry *d;
+
+    initlock(&dcache.lock, "dcache");
+    dcache.head.prev = dcache.head.next = &dcache.head;
+
+    for (d = dcache.entry; d < &dcache.entry[NDENTRY]; d++) {
+        d->next = dcache.head.next;
+        d->prev = &dcache.head;
+        dcache.head.next->prev = d;
+        dcache.head.next = d;
+    }
+}
+
+// Return the entry for name in directory dinum, or 0.
+// Caller holds dcache.lock.
+static struct dentry* dcache_find (uint dev, uint dinum, char *name)
+{
+    struct dentry *d;
+
+    for (d = dcache.hash[dhash(dev, dinum, name)]; d != 0; d = d->hnext) {
+        if ((d->dev == dev) && (d->dinum == dinum) && (namecmp(d->name, name) == 0)) {
+            return d;
+        }
+    }
+
+    return 0;
+}
+
+// Unhash d and make it the next to recycle. Caller holds dcache.lock.
+static void dcache_drop (struct dentry *d)
+{
+    struct dentry **pd;
+
+    for (pd = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pd != d; pd = &(*pd)->hnext) {
+    }
+
+    *pd = d->hnext;
+    d->dev = 0;
+
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->prev = dcache.head.prev;
+    d->next = &dcache.head;
+    dcache.head.prev->next = d;
+    dcache.head.prev = d;
+}
+
+// Look up name in directory dinum. On a hit, return 1 and set *ipp
+// to its inode, referenced, or to 0 for a negative entry. The inode
+// is referenced before the entry can go away, so it cannot be freed
+// and reused under us. Return 0 on a miss.
+static int dcache_lookup (uint dev, uint dinum, char *name, struct inode **ipp)
+{
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+
+    if ((d = dcache_find(dev, dinum, name)) == 0) {
+        dcache.misses++;
+        release(&dcache.lock);
+        return 0;
+    }
+
+    // move to the front of the LRU list
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+
+    if (d->inum == 0) {
+        dcache.neghits++;
+        *ipp = 0;
+    } else {
+        dcache.hits++;
+        *ipp = iget(dev, d->inum);
+    }
+
+    release(&dcache.lock);
+    return 1;
+}
+
+// Remember that name in directory dinum is inode inum, or is not
+// there if inum is 0. Caller holds the directory locked.
+static void dcache_enter (uint dev, uint dinum, char *name, uint inum)
+{
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+
+    if ((d = dcache_find(dev, dinum, name)) != 0) {
+        dcache_drop(d);
+    }
+
+    // recycle the least recently used entry
+    d = dcache.head.prev;
+
+    if (d->dev != 0) {
+        dcache_drop(d);
+    }
+
+    d->dev = dev;
+    d->dinum = dinum;
+    strncpy(d->name, name, DIRSIZ);
+    d->inum = inum;
+
+    d->hnext = dcache.hash[dhash(dev, dinum, name)];
+    dcache.hash[dhash(dev, dinum, name)] = d;
+
+    d->next->prev = d->prev;
+    d->prev->next = d->next;
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+
+    release(&dcache.lock);
+}
+
+// Forget name in directory dinum, which is changing.
+static void dcache_inval (uint dev, uint dinum, char *name)
+{
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+
+    if ((d = dcache_find(dev, dinum, name)) != 0) {
+        dcache_drop(d);
+    }
+
+    release(&dcache.lock);
+}
+
+// Forget all the names in directory dinum, which is being freed.
+static void dcache_purge (uint dev, uint dinum)
+{
+    struct dentry *d;
+
+    acquire(&dcache.lock);
+
+    for (d = dcache.entry; d < &dcache.entry[NDENTRY]; d++) {
+        if ((d->dev == dev) && (d->dinum == dinum)) {
+            dcache_drop(d);
+        }
+    }
+
+    release(&dcache.lock);
+}
+
+// Print dentry cache statistics to the console.
+void dcachestat (void)
+{
+    cprintf("dcache: %d hits, %d negative hits, %d misses\n",
+            dcache.hits, dcache.neghits, dcache.misses);
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -661,10 +1590,22 @@ static struct inode* namex (char *path, int nameiparent, char *name)
     if (*path == '/') {
         ip = iget(ROOTDEV, ROOTINO);
     } else {
-        ip = idup(proc->cwd);
+        ip = idup(myproc()->cwd);
     }
 
     while ((path = skipelem(path, name)) != 0) {
+        // a cached name; its directory need not be locked
+        if (!(nameiparent && *path == '\0')
+                && dcache_lookup(ip->dev, ip->inum, name, &next)) {
+            iput(ip);
+
+            if ((ip = next) == 0) {
+                return 0;
+            }
+
+            continue;
+        }
+
         ilock(ip);
 
         if (ip->type != T_DIR) {
@@ -678,7 +1619,10 @@ static struct inode* namex (char *path, int nameiparent, char *name)
             return ip;
         }
 
-        if ((next = dirlookup(ip, name, 0)) == 0) {
+        next = dirlookup(ip, name, 0);
+        dcache_enter(ip->dev, ip->inum, name, next ? next->inum : 0);
+
+        if (next == 0) {
             iunlockput(ip);
             return 0;
         }
@@ -1,15 +1,25 @@
 // On-disk file system format.
 // Both the kernel and user programs use this header file.
 
-// Block 0 is unused.
-// Block 1 is super block.
-// Blocks 2 through sb.ninodes/IPB hold inodes.
-// Then free bitmap blocks holding sb.size bits.
+// The block size, from MINBSIZE to MAXBSIZE, is chosen by mkfs
+// and recorded in the super block. Block numbers count blocks of
+// that size. The macros below that depend on it use BSIZE, which
+// whoever includes this file defines as the block size of the
+// file system at hand (the kernel in defs.h, mkfs on its own).
+//
+// Sector 0 is unused.
+// Sector 1 holds the super block; with 512-byte blocks, that is
+// block 1, otherwise it is part of block 0.
+// From sb.inodestart, sb.ninodes/IPB + 1 blocks hold inodes.
+// Then, from sb.bmapstart, free bitmap blocks holding sb.size bits.
 // Then sb.nblocks data blocks.
 // Then sb.nlog log blocks.
 
-#define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define ROOTINO 1       // root i-number
+#define SECTSIZE 512    // disk sector size
+#define SBSECT 1        // sector of the super block
+#define MINBSIZE 512    // smallest block size
+#define MAXBSIZE 4096   // largest block size
 
 // File system super block
 struct superblock {
@@ -17,11 +27,19 @@ struct superblock {
     uint    nblocks;        // Number of data blocks
     uint    ninodes;        // Number of inodes.
     uint    nlog;           // Number of log blocks
+    uint    bsize;          // Block size (bytes)
+    uint    inodestart;     // Block number of first inode block
+    uint    bmapstart;      // Block number of first free map block
 };
 
-#define NDIRECT 12
+// The block holding the super block, and its offset in it
+#define SBBLOCK       (SBSECT * SECTSIZE / BSIZE)
+#define SBOFF         (SBSECT * SECTSIZE % BSIZE)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -30,20 +48,20 @@ struct dinode {
     short   minor;          // Minor device number (T_DEV only)
     short   nlink;          // Number of links to inode in file system
     uint    size;           // Size of file (bytes)
-    uint    addrs[NDIRECT+1]; // Data block addresses
+    uint    addrs[NDIRECT+2]; // Data block addresses
 };
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
 // Block containing inode i
-#define IBLOCK(i)     ((i) / IPB + 2)
+#define IBLOCK(i, sb) ((i) / IPB + (sb).inodestart)
 
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
 // Block containing bit for block b
-#define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
+#define BBLOCK(b, sb) ((b) / BPB + (sb).bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
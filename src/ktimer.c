@@ -0,0 +1,210 @@
+// Kernel timers, kept on a hierarchical timing wheel.
+//
+// Level 0 of the wheel has a slot for each of the next 64 ticks.
+// Each slot of level 1 covers 64 ticks, of level 2 64*64 ticks,
+// and so on. A timer is put on the lowest level whose range covers
+// its expiry. Whenever the ticks of a level wrap around, the timers
+// in the next slot of the level above are cascaded (re-inserted)
+// into the levels below. Adding or removing a timer takes constant
+// time. Each tick runs one slot of level 0, and cascades at most
+// one slot of each higher level. A timer further away than the
+// wheel reaches (TW_MAX ticks) waits in the furthest slot, and is
+// re-inserted from there instead of fired when it comes round.
+// A sleeping process is woken up once, when its timer fires, not
+// on every tick.
+//
+// The wheel is protected by tickslock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "arm.h"
+#include "spinlock.h"
+#include "ktimer.h"
+
+#define TW_BITS     6
+#define TW_SIZE     (1 << TW_BITS)
+#define TW_MASK     (TW_SIZE - 1)
+#define TW_LEVELS   4
+#define TW_MAX      (1 << (TW_BITS * TW_LEVELS))    // furthest expiry, in ticks
+
+static struct {
+    uint            now;        // the next tick to run the timers of
+    struct ktimer   slot[TW_LEVELS][TW_SIZE];   // list heads
+} wheel;
+
+void ktimer_init (void)
+{
+    struct ktimer *head;
+    int i, j;
+
+    for (i = 0; i < TW_LEVELS; i++) {
+        for (j = 0; j < TW_SIZE; j++) {
+            head = &wheel.slot[i][j];
+            head->prev = head->next = head;
+        }
+    }
+
+    wheel.now = ticks + 1;
+}
+
+// Put t in the slot of the wheel for t->expires, or the furthest
+// one if that is out of reach.
+static void tw_insert (struct ktimer *t)
+{
+    struct ktimer *head;
+    uint delta;
+    int lvl;
+
+    delta = t->expires - wheel.now;
+
+    if ((int) delta < 0) {
+        // already due, run it with the next tick
+        t->expires = wheel.now;
+        delta = 0;
+    }
+
+    if (delta >= TW_MAX) {
+        delta = TW_MAX - 1;
+    }
+
+    for (lvl = 0; delta >= (1 << (TW_BITS * (lvl + 1))); lvl++) {
+    }
+
+    head = &wheel.slot[lvl][((wheel.now + delta) >> (TW_BITS * lvl)) & TW_MASK];
+
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void tw_remove (struct ktimer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = 0;
+}
+
+// Arm t to fire when ticks reaches expires. If that has already
+// happened, t is marked fired right away. Caller holds tickslock,
+// and has brought ticks up to date with timer_sync.
+void ktimer_add (struct ktimer *t, uint expires)
+{
+    t->fired = 0;
+    t->expires = expires;
+
+    if ((int) (expires - ticks) <= 0) {
+        t->fired = 1;
+        return;
+    }
+
+    tw_insert(t);
+    timer_wakeup(t->expires);
+}
+
+// Cancel t if it has not fired yet. Caller holds tickslock.
+void ktimer_del (struct ktimer *t)
+{
+    if (!t->fired) {
+        tw_remove(t);
+        t->fired = 1;
+    }
+}
+
+// Return the first tick, no later than limit, at which the wheel
+// has work to do: a timer to fire, or a slot of timers to cascade.
+// The timer interrupt need not come any earlier than that.
+// Caller holds tickslock.
+uint ktimer_next (uint limit)
+{
+    struct ktimer *head;
+    uint next, base, span, t;
+    int lvl, i, idx;
+
+    next = limit;
+
+    // level 0 has the timers of the next TW_SIZE ticks, in order
+    for (i = 0; i < TW_SIZE; i++) {
+        t = wheel.now + i;
+        head = &wheel.slot[0][t & TW_MASK];
+
+        if (head->next != head) {
+            return ((int) (t - next) < 0) ? t : next;
+        }
+    }
+
+    // a slot of a higher level is due when it is cascaded, at the
+    // first round of its level that starts at or after now
+    for (lvl = 1; lvl < TW_LEVELS; lvl++) {
+        span = 1 << (TW_BITS * lvl);
+        base = (wheel.now + span - 1) & ~(span - 1);
+        idx = (base >> (TW_BITS * lvl)) & TW_MASK;
+
+        for (i = 0; i < TW_SIZE; i++) {
+            head = &wheel.slot[lvl][(idx + i) & TW_MASK];
+
+            if (head->next != head) {
+                t = base + i * span;
+
+                if ((int) (t - next) < 0) {
+                    next = t;
+                }
+
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+// Re-insert the timers in slot idx of level lvl into the lower levels.
+static void tw_cascade (int lvl, int idx)
+{
+    struct ktimer *head, *t;
+
+    head = &wheel.slot[lvl][idx];
+
+    while ((t = head->next) != head) {
+        tw_remove(t);
+        tw_insert(t);
+    }
+}
+
+// Fire the timers that expired, up to the current value of ticks.
+// Called by the timer interrupt with tickslock held.
+void ktimer_run (void)
+{
+    struct ktimer *head, *t;
+    int lvl;
+
+    while ((int) (ticks - wheel.now) >= 0) {
+        // entering a new round of a level: bring the timers for it
+        // down from the level above
+        for (lvl = 1; lvl < TW_LEVELS; lvl++) {
+            if ((wheel.now & ((1 << (TW_BITS * lvl)) - 1)) != 0) {
+                break;
+            }
+
+            tw_cascade(lvl, (wheel.now >> (TW_BITS * lvl)) & TW_MASK);
+        }
+
+        head = &wheel.slot[0][wheel.now & TW_MASK];
+
+        while ((t = head->next) != head) {
+            tw_remove(t);
+
+            // parked in the furthest slot: not due yet
+            if ((int) (t->expires - wheel.now) > 0) {
+                tw_insert(t);
+                continue;
+            }
+
+            t->fired = 1;
+            wakeup(t);
+        }
+
+        wheel.now++;
+    }
+}
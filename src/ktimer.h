@@ -0,0 +1,13 @@
+#ifndef KTIMER_INCLUDE_
+#define KTIMER_INCLUDE_
+
+// A kernel timer fires once, at the tick it expires. Firing sets
+// fired and wakes up the processes sleeping on the timer (ktimer.c)
+struct ktimer {
+    uint            expires;    // value of ticks to fire at
+    int             fired;      // set when it has fired
+    struct ktimer*  prev;       // slot in the timer wheel
+    struct ktimer*  next;
+};
+
+#endif
@@ -5,18 +5,24 @@
 #include "fs.h"
 #include "buf.h"
 
-// Simple logging. Each system call that might write the file system
+// Simple logging that allows concurrent FS system calls.
+// Each system call that might write the file system
 // should be surrounded with begin_trans() and commit_trans() calls.
 //
-// The log holds at most one transaction at a time. Commit forces
-// the log (with commit record) to disk, then installs the affected
-// blocks to disk, then erases the log. begin_trans() ensures that
-// only one system call can be in a transaction; others must wait.
+// A log transaction contains the updates of multiple FS system
+// calls (group commit). begin_trans() lets a system call join the
+// open transaction as long as the log has room for the MAXOPBLOCKS
+// blocks it may write on top of what the others have reserved;
+// otherwise it waits. The transaction commits when the last system
+// call in it leaves with commit_trans(). Commit forces the log (with
+// commit record) to disk, then installs the affected blocks to disk,
+// then erases the log. No system call may join while a commit is in
+// progress.
 //
-// Allowing only one transaction at a time means that the file
-// system code doesn't have to worry about the possibility of
-// one transaction reading a block that another one has modified,
-// for example an i-node block.
+// Since all system calls in a transaction commit together, the file
+// system code doesn't have to worry about the possibility of one
+// transaction reading a block that another one has modified, for
+// example an i-node block.
 //
 // Read-only system calls don't need to use transactions, though
 // this means that they may observe uncommitted data. I-node and
@@ -24,25 +30,32 @@
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing sector #s for block A, B, C, ...
+//   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// log_write() only records the block # and pins the modified buffer
+// in the cache (B_DIRTY keeps it from being evicted), so writing the
+// same block many times in a transaction costs one log block. The
+// blocks are copied to the log when the transaction commits. The size
+// of the log is chosen by mkfs, up to the LOGSIZE blocks the header
+// block can describe.
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged sector #s before commit.
+// and to keep track in memory of logged block #s before commit.
 struct logheader {
     int n;
-    int sector[LOGSIZE];
+    int block[LOGSIZE];
 };
 
 struct log {
     struct spinlock lock;
     int start;
     int size;
-    int busy; // a transaction is active
+    int outstanding; // how many FS sys calls are executing
+    int reserved;    // log blocks reserved by the outstanding calls
+    int committing;  // in commit(), please wait
     int dev;
     struct logheader lh;
 };
@@ -61,30 +74,53 @@ void initlog(void)
     initlock(&log.lock, "log");
     readsb(ROOTDEV, &sb);
     log.start = sb.size - sb.nlog;
-    log.size = sb.nlog;
+    log.size = UMIN(sb.nlog, LOGSIZE + 1);
     log.dev = ROOTDEV;
     recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
-static void install_trans(void)
+// Copy committed blocks to their home location. During recovery
+// the blocks come from the log; after a commit, the up-to-date
+// copies are still pinned in the buffer cache.
+static void install_trans(int recovering)
 {
     int tail;
     struct buf *lbuf;
     struct buf *dbuf;
 
     for (tail = 0; tail < log.lh.n; tail++) {
-        lbuf = bread(log.dev, log.start+tail+1); // read log block
-        dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
+        dbuf = bread(log.dev, log.lh.block[tail]); // read dst
 
-        memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+        if (recovering) {
+            lbuf = bread(log.dev, log.start+tail+1); // read log block
+            memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+            brelse(lbuf);
+        }
 
-        bwrite(dbuf);  // write dst to disk
-        brelse(lbuf);
+        bwrite(dbuf);  // write dst to disk, which also unpins it
         brelse(dbuf);
     }
 }
 
+// Copy modified blocks from the cache to the log.
+static void write_log(void)
+{
+    int tail;
+    struct buf *to;
+    struct buf *from;
+
+    for (tail = 0; tail < log.lh.n; tail++) {
+        to = bread(log.dev, log.start+tail+1); // log block
+        from = bread(log.dev, log.lh.block[tail]); // cache block
+
+        memmove(to->data, from->data, BSIZE);
+
+        bwrite(to);  // write the log
+        brelse(from);
+        brelse(to);
+    }
+}
+
 // Read the log header from disk into the in-memory log header
 static void read_head(void)
 {
@@ -97,7 +133,7 @@ static void read_head(void)
     log.lh.n = lh->n;
 
     for (i = 0; i < log.lh.n; i++) {
-        log.lh.sector[i] = lh->sector[i];
+        log.lh.block[i] = lh->block[i];
     }
 
     brelse(buf);
@@ -118,7 +154,7 @@ static void write_head(void)
     hb->n = log.lh.n;
 
     for (i = 0; i < log.lh.n; i++) {
-        hb->sector[i] = log.lh.sector[i];
+        hb->block[i] = log.lh.block[i];
     }
 
     bwrite(buf);
@@ -128,41 +164,113 @@ static void write_head(void)
 static void recover_from_log(void)
 {
     read_head();
-    install_trans(); // if committed, copy from log to disk
+    install_trans(1); // if committed, copy from log to disk
     log.lh.n = 0;
     write_head(); // clear the log
 }
 
-void begin_trans(void)
+// Start an FS operation that writes at most nblocks distinct
+// blocks. Must be paired with commit_ntrans(nblocks).
+void begin_ntrans(int nblocks)
 {
+    if (nblocks > log_maxblocks()) {
+        panic("begin_ntrans: too big");
+    }
+
     acquire(&log.lock);
 
-    while (log.busy) {
-        sleep(&log, &log.lock);
+    for (;;) {
+        if (log.committing) {
+            sleep(&log, &log.lock);
+
+        } else if (log.lh.n + log.reserved + nblocks > log.size - 1) {
+            // this op might exhaust log space; wait for commit.
+            sleep(&log, &log.lock);
+
+        } else {
+            log.outstanding++;
+            log.reserved += nblocks;
+            break;
+        }
     }
 
-    log.busy = 1;
     release(&log.lock);
 }
 
-void commit_trans(void)
+// called at the start of each FS system call.
+void begin_trans(void)
+{
+    begin_ntrans(MAXOPBLOCKS);
+}
+
+// The most blocks a single FS operation may write.
+int log_maxblocks(void)
+{
+    return log.size - 1;
+}
+
+static void commit(void)
 {
     if (log.lh.n > 0) {
+        write_log();     // Write modified blocks from cache to log
         write_head();    // Write header to disk -- the real commit
-        install_trans(); // Now install writes to home locations
+        install_trans(0); // Now install writes to home locations
         log.lh.n = 0;
         write_head();    // Erase the transaction from the log
     }
+}
+
+// called at the end of each FS operation started with
+// begin_ntrans(nblocks). commits if this was the last
+// outstanding operation.
+void commit_ntrans(int nblocks)
+{
+    int do_commit;
+
+    do_commit = 0;
 
     acquire(&log.lock);
-    log.busy = 0;
-    wakeup(&log);
+    log.outstanding--;
+    log.reserved -= nblocks;
+
+    if (log.committing) {
+        panic("log.committing");
+    }
+
+    if (log.outstanding == 0) {
+        do_commit = 1;
+        log.committing = 1;
+
+    } else {
+        // begin_trans() may be waiting for log space,
+        // and decrementing log.outstanding has decreased
+        // the amount of reserved space.
+        wakeup(&log);
+    }
+
     release(&log.lock);
+
+    if (do_commit) {
+        // call commit w/o holding locks, since not allowed
+        // to sleep with locks.
+        commit();
+
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+        release(&log.lock);
+    }
+}
+
+// called at the end of each FS system call.
+void commit_trans(void)
+{
+    commit_ntrans(MAXOPBLOCKS);
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Append the block to the log and record the block number,
-// but don't write the log header (which would commit the write).
+// Record the block number and pin the buffer in the cache;
+// commit() copies it to the log. Nothing is written yet.
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
 //   modify bp->data[]
@@ -170,35 +278,32 @@ void commit_trans(void)
 //   brelse(bp)
 void log_write(struct buf *b)
 {
-    struct buf *lbuf;
     int i;
 
-    if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) {
-        panic("too big a transaction");
-    }
+    acquire(&log.lock);
 
-    if (!log.busy) {
+    if (log.outstanding < 1) {
         panic("write outside of trans");
     }
 
     for (i = 0; i < log.lh.n; i++) {
-        if (log.lh.sector[i] == b->sector) { // log absorbtion?
+        if (log.lh.block[i] == b->blockno) { // log absorbtion?
             break;
         }
     }
 
-    log.lh.sector[i] = b->sector;
-    lbuf = bread(b->dev, log.start+i+1);
-
-    memmove(lbuf->data, b->data, BSIZE);
-    bwrite(lbuf);
-    brelse(lbuf);
-
+    // only a block not logged yet needs a slot
     if (i == log.lh.n) {
+        if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1) {
+            panic("too big a transaction");
+        }
+
+        log.lh.block[i] = b->blockno;
         log.lh.n++;
     }
 
-    b->flags |= B_DIRTY; // XXX prevent eviction
+    b->flags |= B_DIRTY; // pin in the cache until commit
+    release(&log.lock);
 }
 
 //PAGEBREAK!
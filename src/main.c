@@ -10,15 +10,55 @@
 extern void* end;
 
 struct cpu	cpus[NCPU];
-struct cpu	*cpu;
+int			ncpu;
 
 #define MB (1024*1024)
 
+#if BOARD_NCPU > 1
+// Start the other cores and wait until they are all running.
+static void startothers (void)
+{
+    int i;
+
+    ncpu = UMIN(mp_ncpu(), NCPU);
+
+    for (i = 1; i < ncpu; i++) {
+        cpus[i].id = i;
+    }
+
+    mp_startothers ();
+
+    for (i = 1; i < ncpu; i++) {
+        while (!cpus[i].started) {
+        }
+    }
+}
+
+// The other cores come here from start_ap (start.c), with paging
+// enabled, on their boot stacks.
+void mpenter (void)
+{
+    struct cpu *c;
+
+    c = &cpus[cpuid()];
+    setcpu (c);
+
+    trap_init_stacks ();		// stacks for the exception modes
+    pic_init_cpu ();			// this core's interrupt controller interface
+
+    cprintf ("cpu%d: starting\n", c->id);
+    xchg(&c->started, 1);
+
+    scheduler();				// start running processes
+}
+#endif
+
 void kmain (void)
 {
     uint vectbl;
 
-    cpu = &cpus[0];
+    setcpu (&cpus[0]);
+    ncpu = 1;
 
     uart_init (P2V(UART0));
 
@@ -33,19 +73,27 @@ void kmain (void)
     
     kmem_init ();
     kmem_init2(P2V(INIT_KERNMAP), P2V(PHYSTOP));
+    slabinit ();
     
     trap_init ();				// vector table and stacks for models
-    pic_init (P2V(VIC_BASE));	// interrupt controller
+    pic_init (P2V(PIC_BASE));	// interrupt controller
     uart_enable_rx ();			// interrupt for uart
     consoleinit ();				// console
     pinit ();					// process (locks)
 
+    ideinit ();					// ide (memory block device)
+    fsinit (ROOTDEV);			// block size of the file system
     binit ();					// buffer cache
     fileinit ();				// file table
+    pipeinit ();				// pipes
+    pcinit ();					// page cache
     iinit ();					// inode cache
-    ideinit ();					// ide (memory block device)
     timer_init (HZ);			// the timer (ticker)
 
+#if BOARD_NCPU > 1
+    startothers ();				// start the other cores
+#endif
+
 
     sti ();
 
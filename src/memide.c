@@ -8,6 +8,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "fs.h"
 
 // a file system image, embeded
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
@@ -18,7 +19,7 @@ static uchar *memdisk;
 void ideinit(void)
 {
     memdisk = _binary_fs_img_start;
-    disksize = (uint)_binary_fs_img_size/512;
+    disksize = (uint)_binary_fs_img_size/SECTSIZE;
 }
 
 // Interrupt handler.
@@ -33,6 +34,7 @@ void ideintr(void)
 void iderw(struct buf *b)
 {
     uchar *p;
+    uint sector;
 
     if(!(b->flags & B_BUSY)) {
         panic("iderw: buf not busy");
@@ -46,17 +48,20 @@ void iderw(struct buf *b)
         panic("iderw: request not for disk 1");
     }
 
-    if(b->sector >= disksize) {
-        panic("iderw: sector out of range");
+    // a block is BSIZE/SECTSIZE consecutive sectors, moved at once
+    sector = b->blockno * (BSIZE / SECTSIZE);
+
+    if(sector + BSIZE / SECTSIZE > disksize) {
+        panic("iderw: block out of range");
     }
 
-    p = memdisk + b->sector*512;
+    p = memdisk + sector*SECTSIZE;
 
     if(b->flags & B_DIRTY){
         b->flags &= ~B_DIRTY;
-        memmove(p, b->data, 512);
+        memmove(p, b->data, BSIZE);
     } else {
-        memmove(b->data, p, 512);
+        memmove(b->data, p, BSIZE);
     }
 
     b->flags |= B_VALID;
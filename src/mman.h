@@ -0,0 +1,3 @@
+// flags of mmap
+#define MAP_WRITE       0x001   // the mapping is writable
+#define MAP_SHARED      0x002   // writes go back to the file, instead of private copies
@@ -34,6 +34,16 @@
 #define KPDE_TYPE   0x02    // use "section" type for kernel page directory
 #define UPDE_TYPE   0x01    // use "coarse page table" for user page directory
 #define PTE_TYPE    0x02    // executable user page(subpage disable)
+#define PTE_APX     (1 << 9)// with AP_KUR: read-only for the kernel as well
+#define PTE_COW     (1 << 11)// copy-on-write page. This is the nG bit, which
+                            // has no effect as we flush the TLB on switches
+
+// data fault status register
+#define DFS_STATUS(s) (((s) & 0x0F) | (((s) >> 6) & 0x10))
+#define DFS_WRITE   (1 << 11)   // the faulting access was a write
+#define FS_TRANS_SEC 0x05       // translation fault, section (no page table)
+#define FS_TRANS_PG 0x07        // translation fault, page
+#define FS_PERM_PG  0x0F        // permission fault, page
 
 // 1st-level or large (1MB) page directory (always maps 1MB memory)
 #define PDE_SHIFT   20                      // shift how many bits to get PDE index
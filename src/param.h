@@ -5,16 +5,28 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO        32  // scheduling priorities, 0 is the highest
+#define QUANTUM       5  // ticks a process runs before it is preempted
+#define MAG_SIZE     16  // free blocks cached per CPU for each hot order
+#define MAG_BATCH     8  // blocks moved at a time to/from the buddy allocator
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NBUF         32  // minimum size of disk block cache
+#define BCACHE_SHIFT  7  // disk block cache gets (PHYSTOP >> BCACHE_SHIFT) bytes
+#define NBHASH     1024  // buckets in the disk block cache hash table
+#define RA_MAXWIN    32  // max blocks read ahead of a sequential reader
+#define NBMAP        32  // block addresses an inode caches from its indirect blocks
+#define NDENTRY     128  // entries in the name lookup (dentry) cache
+#define NICACHE     256  // unreferenced inodes kept cached before recycling
+#define NIHASH      256  // buckets in the inode cache hash table
+#define NVMA         16  // file-backed memory regions (segments, mmaps) per process
+#define NPCACHE     256  // pages in the page cache for program text
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define LOGSIZE      10  // max data sectors in on-disk log
+#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
+#define LOGSIZE     126  // max data blocks in on-disk log (header fits a block)
 
-#define HZ           10
+#define HZ          100  // ticks per second (the timer is tickless)
 
 #define N_CALLSTK    15
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+// Page cache: whole pages of file contents, mapped read-only
+// into user space. Processes running the same program share
+// its text pages instead of each reading a private copy.
+//
+// A cached page is keyed by (dev, inum, page number in the file)
+// and holds one reference to the physical page; every mapping
+// holds another. Pages only the cache refers to are recycled in
+// LRU order. Writing a file updates its cached pages in place, so
+// that every process that mapped them sees the new contents, and
+// a shared mapping written back later keeps them. A file is only
+// truncated, and its pages dropped, once nothing maps it.
+//
+// Callers hold the inode's sleep-lock, so two processes faulting
+// on the same page are serialized and read it only once.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "arm.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH         64
+#define PCHASH(dev, inum, pgno) (((dev) ^ (inum) * 31 ^ (pgno)) & (NPCHASH - 1))
+
+struct pcpage {
+    uint            dev;
+    uint            inum;
+    uint            pgno;
+    uint            pa;         // physical page, 0 if the slot is free
+    struct pcpage*  prev;       // LRU list
+    struct pcpage*  next;
+    struct pcpage*  hnext;      // hash chain
+};
+
+static struct {
+    struct spinlock lock;
+    struct pcpage   page[NPCACHE];
+
+    // Linked list of all pages, through prev/next.
+    // head.next is most recently used.
+    struct pcpage   head;
+    struct pcpage*  hash[NPCHASH];
+
+    uint            hits;
+    uint            misses;
+} pcache;
+
+void pcinit (void)
+{
+    struct pcpage *pg;
+
+    initlock(&pcache.lock, "pcache");
+
+    pcache.head.prev = &pcache.head;
+    pcache.head.next = &pcache.head;
+
+    for (pg = pcache.page; pg < pcache.page + NPCACHE; pg++) {
+        pg->next = pcache.head.next;
+        pg->prev = &pcache.head;
+        pcache.head.next->prev = pg;
+        pcache.head.next = pg;
+    }
+}
+
+// Move pg to the front (most recently used) of the LRU list.
+static void pc_touch (struct pcpage *pg)
+{
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+}
+
+// Remove pg from its hash chain and drop the cache's reference.
+static void pc_evict (struct pcpage *pg)
+{
+    struct pcpage **pp;
+
+    for (pp = &pcache.hash[PCHASH(pg->dev, pg->inum, pg->pgno)]; *pp; pp = &(*pp)->hnext) {
+        if (*pp == pg) {
+            *pp = pg->hnext;
+            break;
+        }
+    }
+
+    free_upage(pg->pa);
+    pg->pa = 0;
+}
+
+// Return the physical address of page pgno of ip, with a reference
+// for the caller, reading it from the file if it is not cached.
+// Bytes past the end of the file are zero. Caller holds ip's lock.
+// Return 0 if out of memory or on a read error, or if the page is
+// to be shared but the cache has no room for it.
+uint pcache_get (struct inode *ip, uint pgno, int shared)
+{
+    struct pcpage *pg;
+    char *mem;
+    uint off, n;
+
+    acquire(&pcache.lock);
+
+    for (pg = pcache.hash[PCHASH(ip->dev, ip->inum, pgno)]; pg; pg = pg->hnext) {
+        if ((pg->dev == ip->dev) && (pg->inum == ip->inum) && (pg->pgno == pgno)) {
+            pc_touch(pg);
+            dup_upage(pg->pa);
+            pcache.hits++;
+            release(&pcache.lock);
+            return pg->pa;
+        }
+    }
+
+    pcache.misses++;
+    release(&pcache.lock);
+
+    if ((mem = alloc_upage()) == 0) {
+        return 0;
+    }
+
+    memset(mem, 0, PTE_SZ);
+    off = pgno << PTE_SHIFT;
+    n = 0;
+
+    if (off < ip->size) {
+        n = UMIN(PTE_SZ, ip->size - off);
+    }
+
+    if ((n > 0) && (readi(ip, mem, off, n) != n)) {
+        free_upage(v2p(mem));
+        return 0;
+    }
+
+    // the page may be program text
+    sync_icache(mem, PTE_SZ);
+
+    // Recycle the least recently used page nobody has mapped.
+    // If every page is mapped, the caller just gets a private one,
+    // unless it must be shared.
+    acquire(&pcache.lock);
+
+    for (pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev) {
+        if ((pg->pa == 0) || (upage_ref(pg->pa) == 1)) {
+            if (pg->pa != 0) {
+                pc_evict(pg);
+            }
+
+            pg->dev = ip->dev;
+            pg->inum = ip->inum;
+            pg->pgno = pgno;
+            pg->pa = v2p(mem);
+            dup_upage(pg->pa);
+
+            pg->hnext = pcache.hash[PCHASH(ip->dev, ip->inum, pgno)];
+            pcache.hash[PCHASH(ip->dev, ip->inum, pgno)] = pg;
+            pc_touch(pg);
+
+            ip->flags |= I_PCACHE;
+            break;
+        }
+    }
+
+    release(&pcache.lock);
+
+    if (shared && (pg == &pcache.head)) {
+        cprintf("pcache_get: no room for a shared page\n");
+        free_upage(v2p(mem));
+        return 0;
+    }
+
+    return v2p(mem);
+}
+
+// Copy the n bytes at src, which are being written to ip at off,
+// into the cached pages of ip. Caller holds ip's lock.
+void pcache_update (struct inode *ip, char *src, uint off, uint n)
+{
+    struct pcpage *pg;
+    char *dst;
+    uint pgno, m;
+
+    acquire(&pcache.lock);
+
+    for (; n > 0; n -= m, off += m, src += m) {
+        pgno = off >> PTE_SHIFT;
+        m = UMIN(n, PTE_SZ - off % PTE_SZ);
+
+        for (pg = pcache.hash[PCHASH(ip->dev, ip->inum, pgno)]; pg; pg = pg->hnext) {
+            if ((pg->dev == ip->dev) && (pg->inum == ip->inum) && (pg->pgno == pgno)) {
+                // a shared mapping being written back is the page itself
+                if ((dst = (char*) p2v(pg->pa) + off % PTE_SZ) != src) {
+                    memmove(dst, src, m);
+                    sync_icache(dst, m);
+                }
+
+                break;
+            }
+        }
+    }
+
+    release(&pcache.lock);
+}
+
+// Drop the cached pages of ip, which is being truncated
+// or is leaving the inode cache.
+void pcache_inval (struct inode *ip)
+{
+    struct pcpage *pg;
+
+    acquire(&pcache.lock);
+
+    for (pg = pcache.page; pg < pcache.page + NPCACHE; pg++) {
+        if ((pg->pa != 0) && (pg->dev == ip->dev) && (pg->inum == ip->inum)) {
+            pc_evict(pg);
+        }
+    }
+
+    release(&pcache.lock);
+    ip->flags &= ~I_PCACHE;
+}
+
+// Print statistics of the page cache to the console.
+void pcstat (void)
+{
+    struct pcpage *pg;
+    int n;
+
+    acquire(&pcache.lock);
+
+    for (n = 0, pg = pcache.page; pg < pcache.page + NPCACHE; pg++) {
+        if (pg->pa != 0) {
+            n++;
+        }
+    }
+
+    cprintf("pcache: %d/%d pages, %d hits, %d misses\n",
+            n, NPCACHE, pcache.hits, pcache.misses);
+
+    release(&pcache.lock);
+}
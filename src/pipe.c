@@ -7,39 +7,94 @@
 #include "file.h"
 #include "spinlock.h"
 
-#define PIPESIZE 512
+// The buffer of a pipe is a ring of whole pages, allocated one by
+// one so that a large pipe needs no contiguous memory. Its size is
+// chosen when the pipe is made (pipe2), a power of two pages.
+#define PIPESIZE    PTE_SZ          // default size of a pipe
+#define PIPE_MAXPG  16              // pages in the largest pipe
 
 struct pipe {
     struct spinlock lock;
-    char data[PIPESIZE];
+    char*   page[PIPE_MAXPG];       // the buffer
+    uint    size;                   // bytes in the buffer
     uint nread;     // number of bytes read
     uint nwrite;    // number of bytes written
     int readopen;   // read fd is still open
     int writeopen;  // write fd is still open
+    int rbusy;      // a reader is in the pipe, see pipeclaim
+    int wbusy;      // a writer is in the pipe, see pipeclaim
 };
 
-int pipealloc(struct file **f0, struct file **f1)
+static struct kmem_cache *pipecache;
+
+// the lock survives in freed pipes, so it is initialized only
+// when the slab is made
+static void pipector (void *p)
+{
+    initlock(&((struct pipe*) p)->lock, "pipe");
+}
+
+void pipeinit (void)
+{
+    pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector);
+}
+
+static void pipefree (struct pipe *p)
+{
+    int i;
+
+    for(i = 0; i < PIPE_MAXPG && p->page[i] != 0; i++) {
+        free_page(p->page[i]);
+    }
+
+    kmem_cache_free(pipecache, p);
+}
+
+// Make a pipe with a buffer of at least size bytes (the default
+// if size is 0). Return -1 if size is too large or out of memory.
+int pipealloc(struct file **f0, struct file **f1, uint size)
 {
     struct pipe *p;
+    int npg, i;
 
     p = 0;
     *f0 = *f1 = 0;
 
+    if(size == 0) {
+        size = PIPESIZE;
+    }
+
+    if(size > PIPE_MAXPG * PTE_SZ) {
+        return -1;
+    }
+
+    for(npg = 1; npg * PTE_SZ < size; npg <<= 1) {
+    }
+
     if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0) {
         goto bad;
     }
 
-    if((p = kmalloc (get_order(sizeof(*p)))) == 0) {
+    if((p = kmem_cache_alloc(pipecache)) == 0) {
         goto bad;
     }
 
+    memset(p->page, 0, sizeof(p->page));
+
+    for(i = 0; i < npg; i++) {
+        if((p->page[i] = alloc_page()) == 0) {
+            goto bad;
+        }
+    }
+
+    p->size = npg * PTE_SZ;
     p->readopen = 1;
     p->writeopen = 1;
+    p->rbusy = 0;
+    p->wbusy = 0;
     p->nwrite = 0;
     p->nread = 0;
 
-    initlock(&p->lock, "pipe");
-
     (*f0)->type = FD_PIPE;
     (*f0)->readable = 1;
     (*f0)->writable = 0;
@@ -54,7 +109,7 @@ int pipealloc(struct file **f0, struct file **f1)
     //PAGEBREAK: 20
     bad:
     if(p) {
-        kfree (p, get_order(sizeof*p));
+        pipefree(p);
     }
 
     if(*f0) {
@@ -83,47 +138,98 @@ void pipeclose(struct pipe *p, int writable)
 
     if(p->readopen == 0 && p->writeopen == 0){
         release(&p->lock);
-        kfree (p, get_order(sizeof(*p)));
+        pipefree(p);
 
     } else {
         release(&p->lock);
     }
 }
 
+// Copy between a user buffer and the ring at off, moving at most n
+// bytes and stopping at the end of a page. Return the bytes moved.
+static int pipecopy(struct pipe *p, uint off, char *addr, int n, int write)
+{
+    char *buf;
+
+    off %= p->size;
+    buf = p->page[off / PTE_SZ] + off % PTE_SZ;
+    n = UMIN(n, PTE_SZ - off % PTE_SZ);
+
+    if(write) {
+        memmove(buf, addr, n);
+    } else {
+        memmove(addr, buf, n);
+    }
+
+    return n;
+}
+
+// One reader and one writer at a time are let into the pipe: a
+// reader owns the ring from nread on until it is done, even while
+// it sleeps or, in a splice, has the lock dropped for file I/O, so
+// no other reader can consume the same bytes. Writers likewise.
+// Caller holds p->lock.
+static void pipeclaim(struct pipe *p, int *busy)
+{
+    while(*busy) {
+        sleep(busy, &p->lock);
+    }
+
+    *busy = 1;
+}
+
+static void pipeunclaim(int *busy)
+{
+    *busy = 0;
+    wakeup(busy);
+}
+
 //PAGEBREAK: 40
+// Readers sleep on nread and writers on nwrite. They are woken up
+// only when the pipe stops being empty or full, respectively.
 int pipewrite(struct pipe *p, char *addr, int n)
 {
-    int i;
+    int i, m;
 
     acquire(&p->lock);
+    pipeclaim(p, &p->wbusy);
 
-    for(i = 0; i < n; i++){
-        while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-            if(p->readopen == 0 /*|| proc->killed*/){
+    for(i = 0; i < n; i += m){
+        while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
+            if(p->readopen == 0 /*|| myproc()->killed*/){
+                pipeunclaim(&p->wbusy);
                 release(&p->lock);
                 return -1;
             }
 
-            wakeup(&p->nread);
             sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
         }
 
-        p->data[p->nwrite++ % PIPESIZE] = addr[i];
+        m = UMIN(n - i, p->nread + p->size - p->nwrite);
+        m = pipecopy(p, p->nwrite, addr + i, m, 1);
+
+        if(p->nwrite == p->nread) {
+            wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+        }
+
+        p->nwrite += m;
     }
 
-    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    pipeunclaim(&p->wbusy);
     release(&p->lock);
     return n;
 }
 
 int piperead(struct pipe *p, char *addr, int n)
 {
-    int i;
+    int i, m;
 
     acquire(&p->lock);
+    pipeclaim(p, &p->rbusy);
 
     while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-        if(proc->killed){
+        if(myproc()->killed){
+            pipeunclaim(&p->rbusy);
             release(&p->lock);
             return -1;
         }
@@ -131,16 +237,131 @@ int piperead(struct pipe *p, char *addr, int n)
         sleep(&p->nread, &p->lock); //DOC: piperead-sleep*/
     }
 
-    for(i = 0; i < n; i++){  //DOC: piperead-copy
-        if(p->nread == p->nwrite) {
-            break;
+    for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+        m = UMIN(n - i, p->nwrite - p->nread);
+        m = pipecopy(p, p->nread, addr + i, m, 0);
+
+        if(p->nwrite == p->nread + p->size) {
+            wakeup(&p->nwrite);  //DOC: piperead-wakeup
         }
 
-        addr[i] = p->data[p->nread++ % PIPESIZE];
+        p->nread += m;
     }
 
-    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+    pipeunclaim(&p->rbusy);
     release(&p->lock);
 
     return i;
 }
+
+//PAGEBREAK!
+// Splice: move data between a file and a pipe in the kernel, so it
+// is copied once, straight between the file (or the buffer cache)
+// and the pages of the pipe, instead of through a user buffer.
+// The pipe lock is dropped while the file is read or written, as
+// that may sleep; the claim on the pipe keeps other readers/writers
+// out of the part of the ring being moved meanwhile.
+
+// Move up to n bytes read from file f into pipe p, as pipewrite
+// would write them. Stop early at the end of the file (a short
+// read). Return the bytes moved, or -1 on an error before any.
+int pipefromfile(struct pipe *p, struct file *f, int n)
+{
+    uint off;
+    char *buf;
+    int i, m, r;
+
+    acquire(&p->lock);
+    pipeclaim(p, &p->wbusy);
+    r = 0;
+
+    for(i = 0; i < n; i += r){
+        while(p->nwrite == p->nread + p->size){
+            if(p->readopen == 0){
+                r = -1;
+                goto done;
+            }
+
+            sleep(&p->nwrite, &p->lock);
+        }
+
+        off = p->nwrite % p->size;
+        buf = p->page[off / PTE_SZ] + off % PTE_SZ;
+        m = UMIN(n - i, p->nread + p->size - p->nwrite);
+        m = UMIN(m, PTE_SZ - off % PTE_SZ);
+
+        release(&p->lock);
+        r = fileread(f, buf, m);
+        acquire(&p->lock);
+
+        if(r <= 0) {
+            break;
+        }
+
+        if(p->nwrite == p->nread) {
+            wakeup(&p->nread);
+        }
+
+        p->nwrite += r;
+
+        if(r < m) {
+            i += r;
+            break;
+        }
+    }
+
+done:
+    pipeunclaim(&p->wbusy);
+    release(&p->lock);
+
+    return (i == 0 && r < 0) ? -1 : i;
+}
+
+// Move up to n bytes read from pipe p into file f, as piperead
+// would read them: wait for data if the pipe is empty, then move
+// what there is. Return the bytes moved, or -1 on an error before any.
+int pipetofile(struct pipe *p, struct file *f, int n)
+{
+    uint off;
+    char *buf;
+    int i, m, r;
+
+    acquire(&p->lock);
+    pipeclaim(p, &p->rbusy);
+    r = 0;
+
+    while(p->nread == p->nwrite && p->writeopen){
+        if(myproc()->killed){
+            r = -1;
+            break;
+        }
+
+        sleep(&p->nread, &p->lock);
+    }
+
+    for(i = 0; r >= 0 && i < n && p->nread != p->nwrite; i += r){
+        off = p->nread % p->size;
+        buf = p->page[off / PTE_SZ] + off % PTE_SZ;
+        m = UMIN(n - i, p->nwrite - p->nread);
+        m = UMIN(m, PTE_SZ - off % PTE_SZ);
+
+        release(&p->lock);
+        r = filewrite(f, buf, m);
+        acquire(&p->lock);
+
+        if(r < 0) {
+            break;
+        }
+
+        if(p->nwrite == p->nread + p->size) {
+            wakeup(&p->nwrite);
+        }
+
+        p->nread += r;
+    }
+
+    pipeunclaim(&p->rbusy);
+    release(&p->lock);
+
+    return (i == 0 && r < 0) ? -1 : i;
+}
@@ -24,13 +24,31 @@
 // between two processes, but instead, between the scheduler. Think of scheduler
 // as the idle process.
 //
+// RUNNABLE processes wait in a FIFO run queue per priority, and bit
+// i of the bitmap is set while queue i is not empty. Both picking the
+// next process and making one runnable take constant time, however
+// many processes there are.
+struct runq {
+    uint            bitmap;
+    struct proc*    head[NPRIO];
+    struct proc*    tail[NPRIO];
+};
+
+// SLEEPING processes are kept in a hash table of wait queues keyed by
+// their channel, so that wakeup only looks at the processes that may
+// be sleeping on it, not at the whole process table.
+#define WAITQ_BITS  6
+#define NWAITQ      (1 << WAITQ_BITS)
+#define WAITQ(chan) ((((uint)(chan) >> 2) * 2654435761U) >> (32 - WAITQ_BITS))
+
 struct {
     struct spinlock lock;
     struct proc proc[NPROC];
+    struct runq runq;
+    struct proc* waitq[NWAITQ];
 } ptable;
 
 static struct proc *initproc;
-struct proc *proc;
 
 int nextpid = 1;
 extern void forkret(void);
@@ -43,6 +61,136 @@ void pinit(void)
     initlock(&ptable.lock, "ptable");
 }
 
+// The process running on this CPU, or 0 in the scheduler. Interrupts
+// are disabled while reading cpu->proc, so that we are not moved to
+// another CPU in between.
+struct proc* myproc(void)
+{
+    struct proc *p;
+
+    pushcli();
+    p = mycpu()->proc;
+    popcli();
+
+    return p;
+}
+
+#if BOARD_NCPU > 1
+// Interrupt the other CPUs if any of them idles in scheduler(),
+// now that there is a process to run.
+static void kickidle(void)
+{
+    int i;
+
+    // the run queue must be seen updated before idle is read
+    // (see scheduler)
+    dmb();
+
+    for(i = 0; i < ncpu; i++) {
+        if(cpus[i].idle && &cpus[i] != mycpu()) {
+            pic_sgi_others(PIC_IPI);
+            return;
+        }
+    }
+}
+#endif
+
+// Make p RUNNABLE and append it to the run queue of its priority.
+// Caller holds ptable.lock.
+static void setrunnable(struct proc *p)
+{
+    struct runq *rq;
+
+    rq = &ptable.runq;
+
+    p->state = RUNNABLE;
+    p->qnext = 0;
+
+    if(rq->tail[p->prio] != 0) {
+        rq->tail[p->prio]->qnext = p;
+    } else {
+        rq->head[p->prio] = p;
+        rq->bitmap |= 1 << p->prio;
+    }
+
+    rq->tail[p->prio] = p;
+
+#if BOARD_NCPU > 1
+    kickidle();
+#endif
+}
+
+// Take the first process of the highest non-empty priority off
+// the run queue, or return 0 if nothing is runnable.
+// Caller holds ptable.lock.
+static struct proc* pickproc(void)
+{
+    struct runq *rq;
+    struct proc *p;
+    int prio;
+
+    rq = &ptable.runq;
+
+    if(rq->bitmap == 0) {
+        return 0;
+    }
+
+    prio = __builtin_ctz(rq->bitmap);
+    p = rq->head[prio];
+
+    if((rq->head[prio] = p->qnext) == 0) {
+        rq->tail[prio] = 0;
+        rq->bitmap &= ~(1 << prio);
+    }
+
+    p->qnext = 0;
+    return p;
+}
+
+// Remove the RUNNABLE process p from the run queue of its priority.
+// Caller holds ptable.lock.
+static void unqueue(struct proc *p)
+{
+    struct runq *rq;
+    struct proc **pp, *prev;
+
+    rq = &ptable.runq;
+    prev = 0;
+
+    for(pp = &rq->head[p->prio]; *pp != p; pp = &(*pp)->qnext) {
+        prev = *pp;
+    }
+
+    *pp = p->qnext;
+
+    if(rq->tail[p->prio] == p) {
+        rq->tail[p->prio] = prev;
+    }
+
+    if(rq->head[p->prio] == 0) {
+        rq->bitmap &= ~(1 << p->prio);
+    }
+
+    p->qnext = 0;
+}
+
+// Remove the SLEEPING process p from the wait queue of its channel.
+// Caller holds ptable.lock.
+static void unsleep(struct proc *p)
+{
+    struct proc **pp;
+
+    for(pp = &ptable.waitq[WAITQ(p->chan)]; *pp != 0; pp = &(*pp)->qnext) {
+        if(*pp == p) {
+            *pp = p->qnext;
+            p->qnext = 0;
+            return;
+        }
+    }
+
+    panic("unsleep");
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -144,31 +292,42 @@ void userinit(void)
 
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
+    p->prio = PRIO_DEFAULT;
 
-    p->state = RUNNABLE;
+    acquire(&ptable.lock);
+    setrunnable(p);
+    release(&ptable.lock);
 }
 
-// Grow current process's memory by n bytes.
+// Grow current process's memory by n bytes. Growth only reserves
+// the address space; pages are allocated when first touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
+    struct proc *curproc;
     uint sz;
 
-    sz = proc->sz;
+    curproc = myproc();
+    sz = curproc->sz;
 
     if(n > 0){
-        if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0) {
+        // the heap may not grow into the mapped files
+        if(uvm_mapped(curproc, sz, sz + n)) {
+            return -1;
+        }
+
+        if((sz = reserveuvm(curproc->pgdir, sz, sz + n)) == 0) {
             return -1;
         }
 
     } else if(n < 0){
-        if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0) {
+        if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0) {
             return -1;
         }
     }
 
-    proc->sz = sz;
-    switchuvm(proc);
+    curproc->sz = sz;
+    switchuvm(curproc);
 
     return 0;
 }
@@ -179,7 +338,9 @@ int growproc(int n)
 int fork(void)
 {
     int i, pid;
-    struct proc *np;
+    struct proc *np, *curproc;
+
+    curproc = myproc();
 
     // Allocate process.
     if((np = allocproc()) == 0) {
@@ -187,31 +348,36 @@ int fork(void)
     }
 
     // Copy process state from p.
-    if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+    if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, curproc->vma)) == 0){
         free_page(np->kstack);
         np->kstack = 0;
         np->state = UNUSED;
         return -1;
     }
 
-    np->sz = proc->sz;
-    np->parent = proc;
-    *np->tf = *proc->tf;
+    np->sz = curproc->sz;
+    np->parent = curproc;
+    *np->tf = *curproc->tf;
 
     // Clear r0 so that fork returns 0 in the child.
     np->tf->r0 = 0;
 
     for(i = 0; i < NOFILE; i++) {
-        if(proc->ofile[i]) {
-            np->ofile[i] = filedup(proc->ofile[i]);
+        if(curproc->ofile[i]) {
+            np->ofile[i] = filedup(curproc->ofile[i]);
         }
     }
 
-    np->cwd = idup(proc->cwd);
+    np->cwd = idup(curproc->cwd);
+    dupvmas(np->vma, curproc->vma);
 
     pid = np->pid;
-    np->state = RUNNABLE;
-    safestrcpy(np->name, proc->name, sizeof(proc->name));
+    np->prio = curproc->prio;
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+    acquire(&ptable.lock);
+    setrunnable(np);
+    release(&ptable.lock);
 
     return pid;
 }
@@ -221,32 +387,40 @@ int fork(void)
 // until its parent calls wait() to find out it exited.
 void exit(void)
 {
-    struct proc *p;
+    struct proc *p, *curproc;
     int fd;
 
-    if(proc == initproc) {
+    curproc = myproc();
+
+    if(curproc == initproc) {
         panic("init exiting");
     }
 
     // Close all open files.
     for(fd = 0; fd < NOFILE; fd++){
-        if(proc->ofile[fd]){
-            fileclose(proc->ofile[fd]);
-            proc->ofile[fd] = 0;
+        if(curproc->ofile[fd]){
+            fileclose(curproc->ofile[fd]);
+            curproc->ofile[fd] = 0;
         }
     }
 
-    iput(proc->cwd);
-    proc->cwd = 0;
+    syncvmas(curproc);
+
+    begin_trans();
+    freevmas(curproc->vma);
+    commit_trans();
+
+    iput(curproc->cwd);
+    curproc->cwd = 0;
 
     acquire(&ptable.lock);
 
     // Parent might be sleeping in wait().
-    wakeup1(proc->parent);
+    wakeup1(curproc->parent);
 
     // Pass abandoned children to init.
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->parent == proc){
+        if(p->parent == curproc){
             p->parent = initproc;
 
             if(p->state == ZOMBIE) {
@@ -256,19 +430,29 @@ void exit(void)
     }
 
     // Jump into the scheduler, never to return.
-    proc->state = ZOMBIE;
+    curproc->state = ZOMBIE;
     sched();
 
     panic("zombie exit");
 }
 
+static void ruadd(struct rusage *to, struct rusage *from)
+{
+    to->utime += from->utime;
+    to->stime += from->stime;
+    to->nvcsw += from->nvcsw;
+    to->nivcsw += from->nivcsw;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(void)
 {
-    struct proc *p;
+    struct proc *p, *curproc;
     int havekids, pid;
 
+    curproc = myproc();
+
     acquire(&ptable.lock);
 
     for(;;){
@@ -276,7 +460,7 @@ int wait(void)
         havekids = 0;
 
         for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if(p->parent != proc) {
+            if(p->parent != curproc) {
                 continue;
             }
 
@@ -288,6 +472,10 @@ int wait(void)
                 free_page(p->kstack);
                 p->kstack = 0;
                 freevm(p->pgdir);
+                ruadd(&curproc->cru, &p->ru);
+                ruadd(&curproc->cru, &p->cru);
+                memset(&p->ru, 0, sizeof(p->ru));
+                memset(&p->cru, 0, sizeof(p->cru));
                 p->state = UNUSED;
                 p->pid = 0;
                 p->parent = 0;
@@ -300,13 +488,13 @@ int wait(void)
         }
 
         // No point waiting if we don't have any children.
-        if(!havekids || proc->killed){
+        if(!havekids || curproc->killed){
             release(&ptable.lock);
             return -1;
         }
 
         // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-        sleep(proc, &ptable.lock);  //DOC: wait-sleep
+        sleep(curproc, &ptable.lock);  //DOC: wait-sleep
     }
 }
 
@@ -326,29 +514,47 @@ void scheduler(void)
         // Enable interrupts on this processor.
         sti();
 
-        // Loop over process table looking for process to run.
+        // Run processes as long as the run queue has any.
         acquire(&ptable.lock);
 
-        for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-            if(p->state != RUNNABLE) {
-                continue;
-            }
-
+        while((p = pickproc()) != 0){
             // Switch to chosen process.  It is the process's job
             // to release ptable.lock and then reacquire it
             // before jumping back to us.
-            proc = p;
+            mycpu()->proc = p;
+            mycpu()->lasttick = ticks;
             switchuvm(p);
 
             p->state = RUNNING;
+            p->slice = QUANTUM;
 
-            swtch(&cpu->scheduler, proc->context);
+            swtch(&mycpu()->scheduler, p->context);
             // Process is done running for now.
             // It should have changed its p->state before coming back.
-            proc = 0;
+            mycpu()->proc = 0;
         }
 
         release(&ptable.lock);
+
+        // Nothing to run: wait for an interrupt, which may make a
+        // process runnable. Check the run queue again with interrupts
+        // off, so that one which came just before is not slept through
+        // (wfi returns for a pending interrupt, even if masked). Other
+        // CPUs interrupt us when they make a process runnable.
+        cli();
+        mycpu()->idle = 1;
+        dmb();
+
+        if(ptable.runq.bitmap == 0) {
+            wfi();
+        }
+
+        mycpu()->idle = 0;
+
+        // processes to run: the timer has to tick for their quantum
+        if(ptable.runq.bitmap != 0) {
+            timer_busy();
+        }
     }
 }
 
@@ -356,6 +562,7 @@ void scheduler(void)
 // and have changed proc->state.
 void sched(void)
 {
+    struct proc *curproc;
     int intena;
 
     //show_callstk ("sched");
@@ -364,11 +571,13 @@ void sched(void)
         panic("sched ptable.lock");
     }
 
-    if(cpu->ncli != 1) {
+    if(mycpu()->ncli != 1) {
         panic("sched locks");
     }
 
-    if(proc->state == RUNNING) {
+    curproc = myproc();
+
+    if(curproc->state == RUNNING) {
         panic("sched running");
     }
 
@@ -376,20 +585,95 @@ void sched(void)
         panic("sched interruptible");
     }
 
-    intena = cpu->intena;
-    swtch(&proc->context, cpu->scheduler);
-    cpu->intena = intena;
+    intena = mycpu()->intena;
+    swtch(&curproc->context, mycpu()->scheduler);
+    mycpu()->intena = intena;
 }
 
 // Give up the CPU for one scheduling round.
 void yield(void)
 {
+    struct proc *curproc;
+
+    curproc = myproc();
+
     acquire(&ptable.lock);  //DOC: yieldlock
-    proc->state = RUNNABLE;
+    curproc->ru.nivcsw++;
+    setrunnable(curproc);
     sched();
     release(&ptable.lock);
 }
 
+// Charge the ticks since the last charge to the process running on
+// this CPU, as user time if it was interrupted in user mode, and tell
+// whether it has used up its quantum. Called by irq_handler, with
+// interrupts disabled.
+int sched_tick(int user)
+{
+    struct cpu *c;
+    struct proc *p;
+    uint n;
+
+    c = mycpu();
+
+    if((p = c->proc) == 0 || (n = ticks - c->lasttick) == 0) {
+        return 0;
+    }
+
+    c->lasttick += n;
+
+    if(user) {
+        p->ru.utime += n;
+    } else {
+        p->ru.stime += n;
+    }
+
+    p->slice -= n;
+    return p->slice <= 0;
+}
+
+// Called on every timer interrupt, which is taken by the first CPU.
+// Return whether any CPU is running a process, so that the timer keeps
+// ticking for sched_tick. The other such CPUs are interrupted to run
+// their own sched_tick.
+int sched_timer(void)
+{
+    int i, busy;
+
+    busy = mycpu()->proc != 0;
+
+    for(i = 0; i < ncpu; i++) {
+        if(&cpus[i] != mycpu() && cpus[i].proc != 0) {
+#if BOARD_NCPU > 1
+            pic_sgi_others(PIC_IPI);
+#endif
+            busy = 1;
+            break;
+        }
+    }
+
+    return busy;
+}
+
+// Return the resource usage of the current process (who is
+// RUSAGE_SELF), or of its children (RUSAGE_CHILDREN).
+int getrusage(int who, struct rusage *ru)
+{
+    struct proc *curproc;
+
+    curproc = myproc();
+
+    if(who == RUSAGE_SELF) {
+        *ru = curproc->ru;
+    } else if(who == RUSAGE_CHILDREN) {
+        *ru = curproc->cru;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void forkret(void)
@@ -405,6 +689,7 @@ void forkret(void)
         // be run from main().
         first = 0;
         initlog();
+        fsmount(ROOTDEV);
     }
 
     // Return to "caller", actually trapret (see allocproc).
@@ -414,9 +699,11 @@ void forkret(void)
 // Reacquires lock when awakened.
 void sleep(void *chan, struct spinlock *lk)
 {
+    struct proc *p;
+
     //show_callstk("sleep");
 
-    if(proc == 0) {
+    if((p = myproc()) == 0) {
         panic("sleep");
     }
 
@@ -434,12 +721,15 @@ void sleep(void *chan, struct spinlock *lk)
     }
 
     // Go to sleep.
-    proc->chan = chan;
-    proc->state = SLEEPING;
+    p->chan = chan;
+    p->state = SLEEPING;
+    p->qnext = ptable.waitq[WAITQ(chan)];
+    ptable.waitq[WAITQ(chan)] = p;
+    p->ru.nvcsw++;
     sched();
 
     // Tidy up.
-    proc->chan = 0;
+    p->chan = 0;
 
     // Reacquire original lock.
     if(lk != &ptable.lock){  //DOC: sleeplock2
@@ -450,13 +740,20 @@ void sleep(void *chan, struct spinlock *lk)
 
 //PAGEBREAK!
 // Wake up all processes sleeping on chan. The ptable lock must be held.
+// Only chan's wait queue is searched; it may also hold processes
+// sleeping on other channels with the same hash.
 static void wakeup1(void *chan)
 {
-    struct proc *p;
+    struct proc **pp, *p;
 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        if(p->state == SLEEPING && p->chan == chan) {
-            p->state = RUNNABLE;
+    pp = &ptable.waitq[WAITQ(chan)];
+
+    while((p = *pp) != 0) {
+        if(p->chan == chan) {
+            *pp = p->qnext;
+            setrunnable(p);
+        } else {
+            pp = &p->qnext;
         }
     }
 }
@@ -483,7 +780,8 @@ int kill(int pid)
 
             // Wake process from sleep if necessary.
             if(p->state == SLEEPING) {
-                p->state = RUNNABLE;
+                unsleep(p);
+                setrunnable(p);
             }
 
             release(&ptable.lock);
@@ -495,6 +793,42 @@ int kill(int pid)
     return -1;
 }
 
+// Set the scheduling priority of process pid to prio, 0 being the
+// highest. A runnable process moves to the run queue of its new
+// priority; a running one gets it when it next gives up the CPU.
+// Return the old priority, or -1 if there is no such process.
+int setprio(int pid, int prio)
+{
+    struct proc *p;
+    int old;
+
+    if(prio < 0 || prio >= NPRIO) {
+        return -1;
+    }
+
+    acquire(&ptable.lock);
+
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        if(p->pid == pid && p->state != UNUSED){
+            old = p->prio;
+
+            if(p->state == RUNNABLE) {
+                unqueue(p);
+                p->prio = prio;
+                setrunnable(p);
+            } else {
+                p->prio = prio;
+            }
+
+            release(&ptable.lock);
+            return old;
+        }
+    }
+
+    release(&ptable.lock);
+    return -1;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging. Runs when user
 // types ^P on console. No lock to avoid wedging a stuck machine further.
@@ -523,7 +857,9 @@ void procdump(void)
             state = "???";
         }
 
-        cprintf("%d %s %d:%s %d\n", p->pid, state, p->pid, p->name, p->parent->pid);
+        cprintf("%d %s %d:%s %d prio %d user %d sys %d vcsw %d ivcsw %d\n",
+                p->pid, state, p->pid, p->name, p->parent ? p->parent->pid : 0,
+                p->prio, p->ru.utime, p->ru.stime, p->ru.nvcsw, p->ru.nivcsw);
     }
 
     show_callstk("procdump: \n");
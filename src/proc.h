@@ -1,26 +1,54 @@
 #ifndef PROC_INCLUDE_
 #define PROC_INCLUDE_
 
-// Per-CPU state, now we only support one CPU
+#include "rusage.h"
+
+// A per-CPU stack of free blocks of one size, so that the hot
+// allocations do not take the buddy allocator's lock (buddy.c)
+struct magazine {
+    int     n;                  // number of free blocks in blk
+    void*   blk[MAG_SIZE];
+    uint    alloc;              // blocks allocated through this magazine
+    uint    hit;                // ... of those, without taking kmem.lock
+};
+
+#define NMAG    2               // pages and page tables
+
+// Per-CPU state
 struct cpu {
     uchar           id;             // index into cpus[] below
     struct context*   scheduler;    // swtch() here to enter scheduler
     volatile uint   started;        // Has the CPU started?
+    volatile uint   idle;           // Waiting for an interrupt in scheduler()?
+    uint            lasttick;       // ticks when sched_tick last charged the process
 
     int             ncli;           // Depth of pushcli nesting.
     int             intena;         // Were interrupts enabled before pushcli?
 
-    // Cpu-local storage variables; see below
-    struct cpu*     cpu;
+    struct magazine mag[NMAG];      // free blocks for kmalloc
+    int             magflush;       // asked to empty mag[] (see kmalloc)
+
     struct proc*    proc;           // The currently-running process.
 };
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
 
+// Each CPU keeps a pointer to its struct cpu in the privileged
+// thread ID register (TPIDRPRW). Call mycpu() with interrupts
+// disabled, or the process may move to another CPU meanwhile.
+static inline struct cpu* mycpu (void)
+{
+    struct cpu *c;
 
-extern struct cpu* cpu;
-extern struct proc* proc;
+    asm volatile("MRC p15, 0, %[c], c13, c0, 4": [c]"=r" (c)::);
+    return c;
+}
+
+static inline void setcpu (struct cpu *c)
+{
+    asm volatile("MCR p15, 0, %[c], c13, c0, 4": :[c]"r" (c):);
+}
 
 //PAGEBREAK: 17
 // Saved registers for kernel context switches. The context switcher
@@ -50,14 +78,38 @@ struct context {
 };
 
 
+// A region of user memory backed by a file, such as a program
+// segment. Its pages are read from the file when first touched;
+// bytes past filesz are zero.
+struct vma {
+    struct inode*   ip;         // backing file, 0 if the slot is unused
+    uint            vaddr;      // start of the region
+    uint            memsz;      // size of the region
+    uint            off;        // file offset of vaddr
+    uint            filesz;     // bytes of the region backed by the file
+    int             flags;      // VMA_WRITE, VMA_SHARED, VMA_MMAP
+};
+
+#define VMA_WRITE   0x1         // writable
+#define VMA_SHARED  0x2         // pages shared through the page cache,
+                                // written back to the file when unmapped
+#define VMA_MMAP    0x4         // mapped by mmap
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+#define PRIO_DEFAULT    (NPRIO / 2) // priority of the first process
+
 // Per-process state
 struct proc {
     uint            sz;             // Size of process memory (bytes)
     pde_t*          pgdir;          // Page table
     char*           kstack;         // Bottom of kernel stack for this process
     enum procstate  state;          // Process state
+    int             prio;           // Scheduling priority, 0 is the highest
+    struct proc*    qnext;          // Next in the run queue (RUNNABLE) or wait queue (SLEEPING)
+    int             slice;          // Ticks left of its quantum (if RUNNING)
+    struct rusage   ru;             // Ticks used and context switches
+    struct rusage   cru;            // ... of its children it has waited for
     volatile int    pid;            // Process ID
     struct proc*    parent;         // Parent process
     struct trapframe*   tf;         // Trap frame for current syscall
@@ -66,6 +118,7 @@ struct proc {
     int             killed;         // If non-zero, have been killed
     struct file*    ofile[NOFILE];  // Open files
     struct inode*   cwd;            // Current directory
+    struct vma      vma[NVMA];      // File-backed memory regions
     char            name[16];       // Process name (debugging)
 };
 
@@ -74,4 +127,6 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+// Files mapped by mmap are placed from the top of the user address
+// space (UADDR_SZ) down, above the heap.
 #endif
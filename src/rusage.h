@@ -0,0 +1,15 @@
+#ifndef RUSAGE_INCLUDE_
+#define RUSAGE_INCLUDE_
+
+#define RUSAGE_SELF      0  // the calling process
+#define RUSAGE_CHILDREN -1  // its children that have exited and been waited for
+
+// Resource usage of a process (getrusage). Times are in ticks (HZ)
+struct rusage {
+    uint    utime;  // time running in user mode
+    uint    stime;  // time running in the kernel
+    uint    nvcsw;  // voluntary context switches (sleep)
+    uint    nivcsw; // involuntary context switches (quantum expired)
+};
+
+#endif
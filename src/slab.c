@@ -0,0 +1,234 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// Each kind of object (pipes, files, ...) has a cache, created by
+// kmem_cache_create. A cache carves pages from the buddy allocator
+// into equal-sized objects, so an object costs its own size rather
+// than the next power of two. Every page (a slab) starts with a
+// struct slab that chains its free objects; slabs with free objects
+// are kept on the cache's partial list.
+//
+// An optional constructor initializes each object once, when its
+// slab is created. A freed object must be returned in the same
+// constructed state, so the free-list link of a cache with a
+// constructor is kept behind the object instead of inside it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "arm.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NSLABCACHE  16
+
+struct slab {
+    struct kmem_cache*  cache;
+    struct slab*        prev;       // partial list
+    struct slab*        next;
+    void*               free;       // free objects, linked at cache->link
+    uint                inuse;      // objects allocated
+};
+
+struct kmem_cache {
+    struct spinlock lock;
+    char*           name;
+    uint            size;           // object size
+    uint            stride;         // distance between objects
+    uint            link;           // offset of the free-list link
+    uint            perslab;        // objects per slab
+    void            (*ctor)(void*);
+
+    struct slab*    partial;        // slabs with free objects
+    uint            nslab;          // slabs (pages) allocated
+    uint            inuse;          // objects allocated
+    uint            nalloc;         // calls to kmem_cache_alloc
+};
+
+static struct {
+    struct spinlock lock;
+    struct kmem_cache cache[NSLABCACHE];
+    int ncache;
+} slabs;
+
+#define OBJLINK(c, obj) (*(void**) ((char*) (obj) + (c)->link))
+#define OBJ2SLAB(obj)   ((struct slab*) align_dn(obj, PTE_SZ))
+
+void slabinit (void)
+{
+    initlock(&slabs.lock, "slabs");
+}
+
+// Create a cache for objects of size bytes (less than a page).
+// ctor, if not 0, is called on each object when its slab is made.
+struct kmem_cache* kmem_cache_create (char *name, uint size, void (*ctor)(void*))
+{
+    struct kmem_cache *c;
+
+    acquire(&slabs.lock);
+
+    if (slabs.ncache == NSLABCACHE) {
+        panic("kmem_cache_create: too many caches");
+    }
+
+    c = &slabs.cache[slabs.ncache++];
+    release(&slabs.lock);
+
+    memset(c, 0, sizeof(*c));
+    initlock(&c->lock, name);
+
+    c->name = name;
+    c->size = size;
+    c->ctor = ctor;
+    c->stride = align_up(size, sizeof(void*));
+    c->link = 0;
+
+    if (ctor != 0) {
+        c->link = c->stride;
+        c->stride += sizeof(void*);
+    }
+
+    c->perslab = (PTE_SZ - sizeof(struct slab)) / c->stride;
+
+    if (c->perslab == 0) {
+        panic("kmem_cache_create: object too big");
+    }
+
+    return c;
+}
+
+static void slab_link (struct kmem_cache *c, struct slab *s)
+{
+    s->prev = 0;
+    s->next = c->partial;
+
+    if (c->partial != 0) {
+        c->partial->prev = s;
+    }
+
+    c->partial = s;
+}
+
+static void slab_unlink (struct kmem_cache *c, struct slab *s)
+{
+    if (s->prev != 0) {
+        s->prev->next = s->next;
+    } else {
+        c->partial = s->next;
+    }
+
+    if (s->next != 0) {
+        s->next->prev = s->prev;
+    }
+
+    s->prev = s->next = 0;
+}
+
+// Make a new slab for c and put it on the partial list.
+// Caller holds c->lock.
+static struct slab* slab_grow (struct kmem_cache *c)
+{
+    struct slab *s;
+    char *obj;
+    int i;
+
+    if ((s = alloc_page()) == 0) {
+        return 0;
+    }
+
+    s->cache = c;
+    s->free = 0;
+    s->inuse = 0;
+
+    obj = (char*) (s + 1) + (c->perslab - 1) * c->stride;
+
+    for (i = 0; i < c->perslab; i++, obj -= c->stride) {
+        if (c->ctor != 0) {
+            c->ctor(obj);
+        }
+
+        OBJLINK(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    c->nslab++;
+    slab_link(c, s);
+
+    return s;
+}
+
+// Allocate an object from cache c, or return 0 if out of memory.
+// The object is constructed if c has a constructor, and is
+// otherwise in the state it was freed in.
+void* kmem_cache_alloc (struct kmem_cache *c)
+{
+    struct slab *s;
+    void *obj;
+
+    acquire(&c->lock);
+    c->nalloc++;
+
+    if (((s = c->partial) == 0) && ((s = slab_grow(c)) == 0)) {
+        release(&c->lock);
+        return 0;
+    }
+
+    obj = s->free;
+    s->free = OBJLINK(c, obj);
+    s->inuse++;
+    c->inuse++;
+
+    if (s->free == 0) {
+        slab_unlink(c, s);
+    }
+
+    release(&c->lock);
+    return obj;
+}
+
+// Return obj to its cache c. An empty slab goes back to the buddy
+// allocator unless it is the only one with free objects left.
+void kmem_cache_free (struct kmem_cache *c, void *obj)
+{
+    struct slab *s;
+
+    s = OBJ2SLAB(obj);
+
+    if (s->cache != c) {
+        panic("kmem_cache_free");
+    }
+
+    acquire(&c->lock);
+
+    if (s->free == 0) {
+        slab_link(c, s);
+    }
+
+    OBJLINK(c, obj) = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->inuse--;
+
+    if ((s->inuse == 0) && (c->partial != s || s->next != 0)) {
+        slab_unlink(c, s);
+        c->nslab--;
+        free_page(s);
+    }
+
+    release(&c->lock);
+}
+
+// Print the usage of every cache to the console.
+void slabstat (void)
+{
+    struct kmem_cache *c;
+    int i;
+
+    for (i = 0; i < slabs.ncache; i++) {
+        c = &slabs.cache[i];
+
+        cprintf("slab %s: %d bytes, %d/%d in use, %d pages, %d allocs\n",
+                c->name, c->size, c->inuse, c->nslab * c->perslab,
+                c->nslab, c->nalloc);
+    }
+}
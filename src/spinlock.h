@@ -5,7 +5,7 @@ struct spinlock {
     // For debugging:
     char        *name;      // Name of lock.
     struct cpu  *cpu;       // The cpu holding the lock.
-    uint        pcs[10];    // The call stack (an array of program counters)
+    uint        pcs[N_CALLSTK]; // The call stack (an array of program counters)
     // that locked the lock.
 };
 
@@ -139,6 +139,13 @@ void load_pgtlb (uint32* kern_pgtbl, uint32* user_pgtbl)
     val = (uint)user_pgtbl | 0x00;
     asm("MCR p15, 0, %[v], c2, c0, 0": :[v]"r" (val):);
 
+#if BOARD_NCPU > 1
+    // take part in the cache coherency of the SCU (SMP bit)
+    asm("MRC p15, 0, %[r], c1, c0, 1": [r]"=r" (val)::);
+    val |= 0x20;
+    asm("MCR p15, 0, %[r], c1, c0, 1": :[r]"r" (val):);
+#endif
+
     // ok, enable paging using read/modify/write
     asm("MRC p15, 0, %[r], c1, c0, 0": [r]"=r" (val)::);
 
@@ -152,6 +159,7 @@ void load_pgtlb (uint32* kern_pgtbl, uint32* user_pgtbl)
 extern void * edata_entry;
 extern void * svc_stktop;
 extern void kmain (void);
+extern void mpenter (void);
 extern void jump_stack (void);
 
 extern void * edata;
@@ -183,6 +191,11 @@ void start (void)
     set_bootpgtbl(VEC_TBL, 0, 1 << PDE_SHIFT, 0);
     set_bootpgtbl(KERNBASE+DEVBASE, DEVBASE, DEV_MEM_SZ, 1);
 
+#if BOARD_NCPU > 1
+    // enable the snoop control unit, which keeps the caches coherent
+    *(volatile uint32*)SCU_BASE |= 0x01;
+#endif
+
     load_pgtlb (kernel_pgtbl, user_pgtbl);
     jump_stack ();
     
@@ -191,3 +204,17 @@ void start (void)
     
     kmain ();
 }
+
+#if BOARD_NCPU > 1
+// The other cores come here from entry.S once core 0 releases them,
+// each on its boot stack. The boot page tables are still valid: they
+// map the low memory, and kmain has since added the rest of memory
+// to the kernel page table.
+void start_ap (void)
+{
+    load_pgtlb (kernel_pgtbl, user_pgtbl);
+    jump_stack ();
+
+    mpenter ();
+}
+#endif
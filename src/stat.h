@@ -8,4 +8,5 @@ struct stat {
     uint    ino;   // Inode number
     short   nlink; // Number of links to file
     uint    size;  // Size of file in bytes
+    uint    blksize; // Block size of its file system
 };
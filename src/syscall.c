@@ -14,7 +14,7 @@
 // Fetch the int at addr from the current process.
 int fetchint(uint addr, int *ip)
 {
-    if(addr >= proc->sz || addr+4 > proc->sz) {
+    if(addr+4 < addr || uvm_limit(myproc(), addr) < addr+4) {
         return -1;
     }
 
@@ -29,12 +29,11 @@ int fetchstr(uint addr, char **pp)
 {
     char *s, *ep;
 
-    if(addr >= proc->sz) {
+    if((ep = (char*)uvm_limit(myproc(), addr)) == 0) {
         return -1;
     }
 
     *pp = (char*)addr;
-    ep = (char*)proc->sz;
 
     for(s = *pp; s < ep; s++) {
         if(*s == 0) {
@@ -54,7 +53,7 @@ int argint(int n, int *ip)
         panic ("too many system call parameters\n");
     }
 
-    *ip = *(&proc->tf->r1 + n);
+    *ip = *(&myproc()->tf->r1 + n);
 
     return 0;
 }
@@ -64,13 +63,22 @@ int argint(int n, int *ip)
 // lies within the process address space.
 int argptr(int n, char **pp, int size)
 {
+    struct proc *curproc;
     int i;
 
     if(argint(n, &i) < 0) {
         return -1;
     }
 
-    if((uint)i >= proc->sz || (uint)i+size > proc->sz) {
+    curproc = myproc();
+
+    if(size < 0 || (uint)i+size < (uint)i || uvm_limit(curproc, i) < (uint)i+size) {
+        return -1;
+    }
+
+    // allocate any lazily reserved pages now, so that running out
+    // of memory fails the system call instead of the kernel.
+    if(uvm_prefault(curproc, i, size) < 0) {
         return -1;
     }
 
@@ -80,8 +88,8 @@ int argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Only another process sharing an mmap'ed file can change the
+// string between this check and its use by the kernel.)
 int argstr(int n, char **pp)
 {
     int addr;
@@ -114,6 +122,12 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_getrusage(void);
+extern int sys_setprio(void);
+extern int sys_pipe2(void);
+extern int sys_splice(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
 
 static int (*syscalls[])(void) = {
         [SYS_fork]    sys_fork,
@@ -137,16 +151,24 @@ static int (*syscalls[])(void) = {
         [SYS_link]    sys_link,
         [SYS_mkdir]   sys_mkdir,
         [SYS_close]   sys_close,
+        [SYS_getrusage] sys_getrusage,
+        [SYS_pipe2]   sys_pipe2,
+        [SYS_splice]  sys_splice,
+        [SYS_mmap]    sys_mmap,
+        [SYS_munmap]  sys_munmap,
+        [SYS_setprio] sys_setprio,
 };
 
 void syscall(void)
 {
+    struct proc *curproc;
     int num;
     int ret;
 
-    num = proc->tf->r0;
+    curproc = myproc();
+    num = curproc->tf->r0;
 
-    //cprintf ("syscall(%d) from %s(%d)\n", num, proc->name, proc->pid);
+    //cprintf ("syscall(%d) from %s(%d)\n", num, curproc->name, curproc->pid);
 
     if((num > 0) && (num <= NELEM(syscalls)) && syscalls[num]) {
         ret = syscalls[num]();
@@ -155,10 +177,10 @@ void syscall(void)
         // do not set the return value if it is SYS_exec (the user program
         // anyway does not expect us to return anything).
         if (num != SYS_exec) {
-            proc->tf->r0 = ret;
+            curproc->tf->r0 = ret;
         }
     } else {
-        cprintf("%d %s: unknown sys call %d\n", proc->pid, proc->name, num);
-        proc->tf->r0 = -1;
+        cprintf("%d %s: unknown sys call %d\n", curproc->pid, curproc->name, num);
+        curproc->tf->r0 = -1;
     }
 }
@@ -20,3 +20,9 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getrusage 22
+#define SYS_pipe2  23
+#define SYS_splice 24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_setprio 27
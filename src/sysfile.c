@@ -13,6 +13,7 @@
 #include "fs.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -25,7 +26,7 @@ static int argfd(int n, int *pfd, struct file **pf)
         return -1;
     }
 
-    if(fd < 0 || fd >= NOFILE || (f=proc->ofile[fd]) == 0) {
+    if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0) {
         return -1;
     }
 
@@ -44,11 +45,14 @@ static int argfd(int n, int *pfd, struct file **pf)
 // Takes over file reference from caller on success.
 static int fdalloc(struct file *f)
 {
+    struct proc *curproc;
     int fd;
 
+    curproc = myproc();
+
     for(fd = 0; fd < NOFILE; fd++){
-        if(proc->ofile[fd] == 0){
-            proc->ofile[fd] = f;
+        if(curproc->ofile[fd] == 0){
+            curproc->ofile[fd] = f;
             return fd;
         }
     }
@@ -109,7 +113,7 @@ int sys_close(void)
         return -1;
     }
 
-    proc->ofile[fd] = 0;
+    myproc()->ofile[fd] = 0;
     fileclose(f);
 
     return 0;
@@ -204,7 +208,6 @@ static int isdirempty(struct inode *dp)
 int sys_unlink(void)
 {
     struct inode *ip, *dp;
-    struct dirent de;
     char name[DIRSIZ], *path;
     uint off;
 
@@ -240,11 +243,7 @@ int sys_unlink(void)
         goto bad;
     }
 
-    memset(&de, 0, sizeof(de));
-
-    if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de)) {
-        panic("unlink: writei");
-    }
+    dirunlink(dp, name, off);
 
     if(ip->type == T_DIR){
         dp->nlink--;
@@ -419,6 +418,7 @@ int sys_chdir(void)
 {
     char *path;
     struct inode *ip;
+    struct proc *curproc;
 
     if(argstr(0, &path) < 0 || (ip = namei(path)) == 0) {
         return -1;
@@ -433,8 +433,9 @@ int sys_chdir(void)
 
     iunlock(ip);
 
-    iput(proc->cwd);
-    proc->cwd = ip;
+    curproc = myproc();
+    iput(curproc->cwd);
+    curproc->cwd = ip;
 
     return 0;
 }
@@ -473,17 +474,14 @@ int sys_exec(void)
     return exec(path, argv);
 }
 
-int sys_pipe(void)
+// make a pipe of size bytes (0 for the default size), and return
+// its read and write file descriptors in fd[0] and fd[1]
+static int mkpipe(int *fd, uint size)
 {
-    int *fd;
     struct file *rf, *wf;
     int fd0, fd1;
 
-    if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0) {
-        return -1;
-    }
-
-    if(pipealloc(&rf, &wf) < 0) {
+    if(pipealloc(&rf, &wf, size) < 0) {
         return -1;
     }
 
@@ -491,7 +489,7 @@ int sys_pipe(void)
 
     if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
         if(fd0 >= 0) {
-            proc->ofile[fd0] = 0;
+            myproc()->ofile[fd0] = 0;
         }
 
         fileclose(rf);
@@ -505,3 +503,99 @@ int sys_pipe(void)
 
     return 0;
 }
+
+int sys_pipe(void)
+{
+    int *fd;
+
+    if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0) {
+        return -1;
+    }
+
+    return mkpipe(fd, 0);
+}
+
+int sys_pipe2(void)
+{
+    int *fd;
+    int size;
+
+    if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 || argint(1, &size) < 0 || size < 0) {
+        return -1;
+    }
+
+    return mkpipe(fd, size);
+}
+
+// splice(fdin, fdout, n): move up to n bytes from fdin to fdout in
+// the kernel. One of them has to be a pipe; the other may be a file,
+// a device, or another pipe.
+int sys_splice(void)
+{
+    struct file *fin, *fout;
+    int n;
+
+    if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0 || argint(2, &n) < 0 || n < 0) {
+        return -1;
+    }
+
+    if(fin->readable == 0 || fout->writable == 0) {
+        return -1;
+    }
+
+    if(fout->type == FD_PIPE) {
+        if(fin->type == FD_PIPE && fin->pipe == fout->pipe) {
+            return -1;
+        }
+
+        return pipefromfile(fout->pipe, fin, n);
+    }
+
+    if(fin->type == FD_PIPE) {
+        return pipetofile(fin->pipe, fout, n);
+    }
+
+    return -1;
+}
+
+// Map len bytes of a file, from the page-aligned offset off, into
+// the caller's memory. With MAP_SHARED, the pages are those of the
+// page cache, and writes to them are written back to the file when
+// the mapping is removed, or the process exits or execs. Otherwise
+// writes go to private copies.
+int sys_mmap(void)
+{
+    struct file *f;
+    int off, len, flags;
+
+    if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0
+            || argint(3, &flags) < 0) {
+        return 0;
+    }
+
+    if(f->type != FD_INODE || f->ip->type != T_FILE || f->readable == 0) {
+        return 0;
+    }
+
+    if((flags & MAP_SHARED) && (flags & MAP_WRITE) && f->writable == 0) {
+        return 0;
+    }
+
+    if(off < 0 || off % PTE_SZ != 0 || len <= 0) {
+        return 0;
+    }
+
+    return uvm_mmap(myproc(), f->ip, off, len, flags);
+}
+
+// Remove the whole mapping at addr, len bytes long.
+int sys_munmap(void)
+{
+    int addr, len;
+
+    if(argint(0, &addr) < 0 || argint(1, &len) < 0) {
+        return -1;
+    }
+
+    return uvm_munmap(myproc(), addr, len);
+}
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "ktimer.h"
 
 int sys_fork(void)
 {
@@ -35,7 +36,7 @@ int sys_kill(void)
 
 int sys_getpid(void)
 {
-    return proc->pid;
+    return myproc()->pid;
 }
 
 int sys_sbrk(void)
@@ -47,7 +48,7 @@ int sys_sbrk(void)
         return -1;
     }
 
-    addr = proc->sz;
+    addr = myproc()->sz;
 
     if(growproc(n) < 0) {
         return -1;
@@ -56,26 +57,31 @@ int sys_sbrk(void)
     return addr;
 }
 
+// sleep for n ticks on a kernel timer, which wakes us up once it expires
 int sys_sleep(void)
 {
+    struct proc *curproc;
+    struct ktimer t;
     int n;
-    uint ticks0;
 
     if(argint(0, &n) < 0) {
         return -1;
     }
 
+    curproc = myproc();
     acquire(&tickslock);
 
-    ticks0 = ticks;
+    timer_sync();
+    ktimer_add(&t, ticks + n);
 
-    while(ticks - ticks0 < n){
-        if(proc->killed){
+    while(!t.fired){
+        if(curproc->killed){
+            ktimer_del(&t);
             release(&tickslock);
             return -1;
         }
 
-        sleep(&ticks, &tickslock);
+        sleep(&t, &tickslock);
     }
 
     release(&tickslock);
@@ -89,8 +95,34 @@ int sys_uptime(void)
     uint xticks;
 
     acquire(&tickslock);
+    timer_sync();
     xticks = ticks;
     release(&tickslock);
 
     return xticks;
 }
+
+// return the resource usage of this process or its children
+int sys_getrusage(void)
+{
+    struct rusage *ru;
+    int who;
+
+    if(argint(0, &who) < 0 || argptr(1, (void*)&ru, sizeof(*ru)) < 0) {
+        return -1;
+    }
+
+    return getrusage(who, ru);
+}
+
+// set the scheduling priority of a process, returning the old one
+int sys_setprio(void)
+{
+    int pid, prio;
+
+    if(argint(0, &pid) < 0 || argint(1, &prio) < 0) {
+        return -1;
+    }
+
+    return setprio(pid, prio);
+}
@@ -7,20 +7,24 @@
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "types.h"
+#define BSIZE bsize    // the block size is a run-time choice
 #include "fs.h"
 #include "stat.h"
 #include "param.h"
 
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 
-int nblocks = 985;
-int nlog = LOGSIZE;
+#define FSSIZE (512*1024)  // bytes in the image
+
+int nblocks;
+int nlog;
 int ninodes = 200;
-int size = 1024;
+int size;
+uint bsize = 1024;
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[MAXBSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -33,6 +37,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint indirect(uint blk, uint idx);
 
 // convert to intel byte order
 ushort
@@ -63,19 +68,31 @@ main(int argc, char *argv[])
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[512];
+  char buf[MAXBSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-b") == 0){
+    bsize = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-b blocksize] fs.img files...\n");
+    exit(1);
+  }
+
+  if(bsize < MINBSIZE || bsize > MAXBSIZE || (bsize & (bsize - 1)) != 0){
+    fprintf(stderr, "mkfs: block size must be a power of 2 from %d to %d\n",
+            MINBSIZE, MAXBSIZE);
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((bsize % sizeof(struct dinode)) == 0);
+  assert((bsize % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -83,26 +100,42 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  size = FSSIZE / bsize;
+
+  // give the log 1/16 of the image: room for a few concurrent
+  // transactions, and no more than the header block can describe.
+  nlog = size / 16;
+  if(nlog < 3*MAXOPBLOCKS + 1)
+    nlog = 3*MAXOPBLOCKS + 1;
+  if(nlog > LOGSIZE + 1)
+    nlog = LOGSIZE + 1;
+
+  // the inodes start with the block after the super block's
+  sb.inodestart = xint(SBBLOCK + 1);
+  sb.bmapstart = xint(SBBLOCK + 1 + ninodes / IPB + 1);
+
+  bitblocks = size/(bsize*8) + 1;
+  usedblocks = xint(sb.bmapstart) + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
+
   sb.size = xint(size);
-  sb.nblocks = xint(nblocks); // so whole disk is size sectors
+  sb.nblocks = xint(nblocks); // so whole disk is size blocks
   sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
+  sb.bsize = xint(bsize);
 
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
-
-  printf("used %d (bit %d ninode %zu) free %u log %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
+  printf("bsize %u used %d (bit %d ninode %zu) free %u log %u total %d\n", bsize,
+         usedblocks, bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
 
   assert(nblocks + usedblocks + nlog == size);
 
   for(i = 0; i < nblocks + usedblocks + nlog; i++)
     wsect(i, zeroes);
 
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  rsect(SBBLOCK, buf);
+  memmove(buf + SBOFF, &sb, sizeof(sb));
+  wsect(SBBLOCK, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -157,14 +190,15 @@ main(int argc, char *argv[])
   exit(0);
 }
 
+// wsect and rsect move whole blocks of bsize bytes.
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)bsize, 0) != sec * (long)bsize){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, bsize) != bsize){
     perror("write");
     exit(1);
   }
@@ -173,13 +207,13 @@ wsect(uint sec, void *buf)
 uint
 i2b(uint inum)
 {
-  return (inum / IPB) + 2;
+  return IBLOCK(inum, sb);
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -193,7 +227,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -206,11 +240,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)bsize, 0) != sec * (long)bsize){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, bsize) != bsize){
     perror("read");
     exit(1);
   }
@@ -233,36 +267,51 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[MAXBSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < bsize*8);
+  bzero(buf, bsize);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
+  printf("balloc: write bitmap block at block %u\n", xint(sb.bmapstart));
+  wsect(xint(sb.bmapstart), buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry idx of indirect block blk, allocating a block for it
+// if there is none.
+uint
+indirect(uint blk, uint idx)
+{
+  uint a[MAXBSIZE / sizeof(uint)];
+
+  rsect(blk, (char*)a);
+  if(a[idx] == 0){
+    a[idx] = xint(freeblock++);
+    usedblocks++;
+    wsect(blk, (char*)a);
+  }
+  return xint(a[idx]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
-  uint indirect[NINDIRECT];
-  uint x;
+  char buf[MAXBSIZE];
+  uint x, n2;
 
   rinode(inum, &din);
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
+    fbn = off / bsize;
     assert(fbn < MAXFILE);
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
@@ -270,24 +319,24 @@ iappend(uint inum, void *xp, int n)
         usedblocks++;
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
         din.addrs[NDIRECT] = xint(freeblock++);
         usedblocks++;
       }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
+      x = indirect(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
         usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      n2 = fbn - NDIRECT - NINDIRECT;
+      x = indirect(xint(din.addrs[NDIRECT+1]), n2 / NINDIRECT);
+      x = indirect(x, n2 % NINDIRECT);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * bsize - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * bsize), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
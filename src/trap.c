@@ -4,28 +4,51 @@
 #include "param.h"
 #include "arm.h"
 #include "proc.h"
+#include "mmu.h"
 
 // trap routine
 void swi_handler (struct trapframe *r)
 {
-    if (proc->killed)
+    struct proc *curproc;
+
+    curproc = myproc();
+
+    if (curproc->killed)
         exit();
-    proc->tf = r;
+    curproc->tf = r;
     syscall ();
-    if (proc->killed)
+    if (curproc->killed)
         exit();
 }
 
 // trap routine
 void irq_handler (struct trapframe *r)
 {
+    struct proc *curproc;
+    int user;
+
     // proc points to the current process. If the kernel is
-    // running scheduler, proc is NULL.
-    if (proc != NULL) {
-        proc->tf = r;
+    // running scheduler, proc is NULL. The trapframe of an
+    // interrupted system call is kept.
+    curproc = myproc();
+    user = (r->spsr & MODE_MASK) == USR_MODE;
+
+    if (curproc != NULL && user) {
+        curproc->tf = r;
     }
 
     pic_dispatch (r);
+
+    // account the time of the process, and preempt it if it has
+    // used up its quantum. Only user mode is preempted; the kernel
+    // runs until it returns or sleeps.
+    if (sched_tick(user) && user) {
+        yield();
+
+        if (curproc->killed) {
+            exit();
+        }
+    }
 }
 
 // trap routine
@@ -45,33 +68,66 @@ void und_handler (struct trapframe *r)
 // trap routine
 void dabort_handler (struct trapframe *r)
 {
+    struct proc *curproc;
     uint dfs, fa;
 
     cli();
+    curproc = myproc();
 
     // read data fault status register
     asm("MRC p15, 0, %[r], c5, c0, 0": [r]"=r" (dfs)::);
 
     // read the fault address register
     asm("MRC p15, 0, %[r], c6, c0, 0": [r]"=r" (fa)::);
-    
+
+    // a fault on a user page that the VM system can resolve (e.g.,
+    // copy-on-write, or first touch of lazily allocated memory).
+    // Either the user or the kernel, on behalf of the user, may
+    // have faulted. Return to restart the instruction.
+    if ((curproc != NULL) && (uvm_fault(curproc, fa, dfs) == 0)) {
+        return;
+    }
+
     cprintf ("data abort: instruction 0x%x, fault addr 0x%x, reason 0x%x \n",
              r->pc, fa, dfs);
     
     dump_trapframe (r);
+
+    if ((curproc == NULL) || (r->spsr & MODE_MASK) != USR_MODE) {
+        panic("kernel data abort");
+    }
+
+    curproc->killed = 1;
+    exit();
 }
 
 // trap routine
 void iabort_handler (struct trapframe *r)
 {
+    struct proc *curproc;
     uint ifs;
     
-    // read fault status register
-    asm("MRC p15, 0, %[r], c5, c0, 0": [r]"=r" (ifs)::);
+    // read instruction fault status register
+    asm("MRC p15, 0, %[r], c5, c0, 1": [r]"=r" (ifs)::);
 
     cli();
+    curproc = myproc();
+
+    // first execution of a program page not read in yet
+    if ((curproc != NULL) && ((r->spsr & MODE_MASK) == USR_MODE)
+            && (uvm_fault(curproc, r->pc, ifs) == 0)) {
+        return;
+    }
+
     cprintf ("prefetch abort at: 0x%x (reason: 0x%x)\n", r->pc, ifs);
     dump_trapframe (r);
+
+    if ((curproc == NULL) || (r->spsr & MODE_MASK) != USR_MODE) {
+        panic("kernel prefetch abort");
+    }
+
+    curproc->killed = 1;
+    exit();
 }
 
 // trap routine
@@ -93,9 +149,6 @@ void fiq_handler (struct trapframe *r)
 void trap_init ( )
 {
     volatile uint32 *ram_start;
-    char *stk;
-    int i;
-    uint modes[] = {FIQ_MODE, IRQ_MODE, ABT_MODE, UND_MODE};
 
     // the opcode of PC relative load (to PC) instruction LDR pc, [pc,...]
     static uint32 const LDR_PCPC = 0xE59FF000U;
@@ -121,7 +174,17 @@ void trap_init ( )
     ram_start[14] = (uint32)trap_irq;
     ram_start[15] = (uint32)trap_fiq;
 
-    // initialize the stacks for different mode
+    trap_init_stacks ();
+}
+
+// initialize the stacks for different mode. The stack pointers
+// are banked per CPU, so every CPU calls this when it starts.
+void trap_init_stacks (void)
+{
+    char *stk;
+    int i;
+    uint modes[] = {FIQ_MODE, IRQ_MODE, ABT_MODE, UND_MODE};
+
     for (i = 0; i < sizeof(modes)/sizeof(uint); i++) {
         stk = alloc_page ();
 
@@ -129,7 +192,7 @@ void trap_init ( )
             panic("failed to alloc memory for irq stack");
         }
 
-        set_stk (modes[i], (uint)stk);
+        set_stk (modes[i], (uint)stk + PTE_SZ);
     }
 }
 
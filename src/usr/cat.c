@@ -9,6 +9,17 @@ cat(int fd)
 {
     int n;
     
+    // move the data in the kernel if either side is a pipe
+    if((n = splice(fd, 1, sizeof(buf) * 128)) >= 0){
+        while(n > 0)
+            n = splice(fd, 1, sizeof(buf) * 128);
+        if(n < 0){
+            printf(1, "cat: read error\n");
+            exit();
+        }
+        return;
+    }
+    
     while((n = read(fd, buf, sizeof(buf))) > 0)
         write(1, buf, n);
     if(n < 0){
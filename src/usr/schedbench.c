@@ -0,0 +1,154 @@
+// Measure context switches per second as the number of
+// processes grows. Two processes bounce a byte over a pair of
+// pipes, so each of them blocks once per round trip, while a
+// growing number of idle processes sit blocked on another pipe.
+// The rate should stay flat with the scheduler's run queues.
+// Then a process spinning on the CPU is added, first at the lowest
+// priority, where it should not slow the ping-pong down, and then
+// at the same priority, where it takes its share of the CPU.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define RUNTICKS    (2 * HZ)    // how long to measure each step
+
+// Fork n processes that block reading the pipe p until the
+// parent closes its write end.
+int
+spawnidle(int n, int *p)
+{
+    int i, pid;
+    char c;
+
+    for(i = 0; i < n; i++){
+        pid = fork();
+
+        if(pid < 0)
+            return i;
+
+        if(pid == 0){
+            close(p[1]);
+            read(p[0], &c, 1);
+            exit();
+        }
+    }
+
+    return n;
+}
+
+// Bounce a byte with a child for RUNTICKS ticks and return the
+// number of context switches per second.
+int
+pingpong(void)
+{
+    int ping[2], pong[2];
+    int start, n;
+    char c;
+
+    if(pipe(ping) < 0 || pipe(pong) < 0){
+        printf(1, "schedbench: pipe failed\n");
+        exit();
+    }
+
+    if(fork() == 0){
+        close(ping[1]);
+        close(pong[0]);
+
+        while(read(ping[0], &c, 1) == 1 && c == 'p')
+            write(pong[1], &c, 1);
+
+        exit();
+    }
+
+    close(ping[0]);
+    close(pong[1]);
+
+    c = 'p';
+    n = 0;
+    start = uptime();
+
+    while(uptime() - start < RUNTICKS){
+        write(ping[1], &c, 1);
+        read(pong[0], &c, 1);
+        n++;
+    }
+
+    c = 'q';
+    write(ping[1], &c, 1);
+    close(ping[1]);
+    close(pong[0]);
+    wait();
+
+    // each round trip blocks both processes once
+    return 2 * n * HZ / (uptime() - start);
+}
+
+// Measure the ping-pong against a process that never blocks, at
+// the lowest priority and then at ours.
+void
+spinbench(void)
+{
+    int pid, mine;
+
+    pid = fork();
+
+    if(pid < 0){
+        printf(1, "schedbench: fork failed\n");
+        exit();
+    }
+
+    if(pid == 0){
+        for(;;)
+            ;
+    }
+
+    mine = setprio(pid, NPRIO - 1);
+    printf(1, "spinner at lowest priority %d\n", pingpong());
+
+    setprio(pid, mine);
+    printf(1, "spinner at same priority %d\n", pingpong());
+
+    kill(pid);
+    wait();
+}
+
+int
+main(int argc, char *argv[])
+{
+    int idle[2];
+    int n, got, i;
+
+    printf(1, "schedbench: idle procs, switches/sec\n");
+
+    // leave room for init, sh, us and the ping-pong child
+    n = 0;
+
+    for(;;){
+        if(pipe(idle) < 0){
+            printf(1, "schedbench: pipe failed\n");
+            exit();
+        }
+
+        got = spawnidle(n, idle);
+        printf(1, "%d %d\n", got, pingpong());
+
+        close(idle[0]);
+        close(idle[1]);
+
+        for(i = 0; i < got; i++)
+            wait();
+
+        if(n == NPROC - 4)
+            break;
+
+        n = (n == 0) ? 1 : n * 2;
+
+        if(n > NPROC - 4)
+            n = NPROC - 4;
+    }
+
+    spinbench();
+    exit();
+}
@@ -12,6 +12,7 @@
 #define BACK  5
 
 #define MAXARGS 10
+#define PIPESZ  (64*1024)    // buffer of the pipes between commands
 
 struct cmd {
     int type;
@@ -99,7 +100,7 @@ runcmd(struct cmd *cmd)
             
         case PIPE:
             pcmd = (struct pipecmd*)cmd;
-            if(pipe(p) < 0)
+            if(pipe2(p, PIPESZ) < 0)
                 panic("pipe");
             if(fork1() == 0){
                 close(1);
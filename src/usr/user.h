@@ -1,10 +1,15 @@
 struct stat;
+struct rusage;
 
 // system calls
 int fork(void);
 int exit(void) __attribute__((noreturn));
 int wait(void);
 int pipe(int*);
+int pipe2(int*, int);
+int splice(int, int, int);
+char* mmap(int, int, int, int);
+int munmap(char*, int);
 int write(int, void*, int);
 int read(int, void*, int);
 int close(int);
@@ -22,6 +27,8 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getrusage(int, struct rusage*);
+int setprio(int, int);
 
 // ulib.c
 int stat(char*, struct stat*);
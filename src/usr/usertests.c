@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
 #include "syscall.h"
 #include "memlayout.h"
 
@@ -83,20 +84,31 @@ writetest(void)
     printf(stdout, "small file test ok\n");
 }
 
+#define BIGMAX (300*1024)   // largest big file the disk image holds
+
 void
 writetest1(void)
 {
-    int i, fd, n;
+    int i, fd, n, nbig;
+    struct stat st;
     
     printf(stdout, "big files test\n");
     
     fd = open("big", O_CREATE|O_RDWR);
-    if(fd < 0){
+    if(fd < 0 || fstat(fd, &st) < 0){
         printf(stdout, "error: creat big failed!\n");
         exit();
     }
     
-    for(i = 0; i < MAXFILE; i++){
+    // 512-byte writes: past the direct and the indirect blocks, a few
+    // blocks into the double indirect ones. With blocks of 2 KB and
+    // more that is more than the image holds, and the file stops at
+    // BIGMAX bytes, in the indirect range.
+    nbig = (NDIRECT + st.blksize / sizeof(uint) + 4) * (st.blksize / 512);
+    if(nbig > BIGMAX / 512)
+        nbig = BIGMAX / 512;
+    
+    for(i = 0; i < nbig; i++){
         ((int*)buf)[0] = i;
         if(write(fd, buf, 512) != 512){
             printf(stdout, "error: write big file failed\n", i);
@@ -116,7 +128,7 @@ writetest1(void)
     for(;;){
         i = read(fd, buf, 512);
         if(i == 0){
-            if(n == MAXFILE - 1){
+            if(n != nbig){
                 printf(stdout, "read only %d blocks from big", n);
                 exit();
             }
@@ -254,6 +266,247 @@ pipe1(void)
     printf(1, "pipe1 ok\n");
 }
 
+// splice between a file and a pipe, both ways; the second time
+// with a plain reader taking data from the same pipe meanwhile.
+void
+splicetest(void)
+{
+    int fds[2], fd, pid, i, n, total;
+    struct stat st;
+    
+    printf(1, "splice test\n");
+    unlink("splicein");
+    unlink("spliceout");
+    
+    fd = open("splicein", O_CREATE|O_RDWR);
+    if(fd < 0){
+        printf(1, "create splicein failed\n");
+        exit();
+    }
+    for(i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 251;
+    for(i = 0; i < 4; i++){
+        if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+            printf(1, "write splicein failed\n");
+            exit();
+        }
+    }
+    close(fd);
+    
+    // file -> pipe
+    if(pipe(fds) != 0){
+        printf(1, "pipe() failed\n");
+        exit();
+    }
+    pid = fork();
+    if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if(pid == 0){
+        close(fds[0]);
+        fd = open("splicein", 0);
+        while((n = splice(fd, fds[1], 3000)) > 0)
+            ;
+        if(n < 0)
+            printf(1, "splice file to pipe failed\n");
+        exit();
+    }
+    close(fds[1]);
+    total = 0;
+    while((n = read(fds[0], buf, 1000)) > 0){
+        for(i = 0; i < n; i++){
+            if((buf[i] & 0xff) != ((total + i) % sizeof(buf)) % 251){
+                printf(1, "splice file to pipe: wrong data at %d\n", total + i);
+                exit();
+            }
+        }
+        total += n;
+    }
+    close(fds[0]);
+    wait();
+    if(total != 4 * sizeof(buf)){
+        printf(1, "splice file to pipe: got %d bytes\n", total);
+        exit();
+    }
+    
+    // pipe -> file, with a reader competing for the data
+    if(pipe(fds) != 0){
+        printf(1, "pipe() failed\n");
+        exit();
+    }
+    pid = fork();
+    if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if(pid == 0){
+        close(fds[0]);
+        memset(buf, 's', sizeof(buf));
+        for(i = 0; i < 4; i++)
+            write(fds[1], buf, sizeof(buf));
+        exit();
+    }
+    pid = fork();
+    if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if(pid == 0){
+        close(fds[1]);
+        fd = open("spliceout", O_CREATE|O_RDWR);
+        while((n = splice(fds[0], fd, 5000)) > 0)
+            ;
+        if(n < 0)
+            printf(1, "splice pipe to file failed\n");
+        close(fd);
+        exit();
+    }
+    close(fds[1]);
+    total = 0;
+    while((n = read(fds[0], buf, 100)) > 0){
+        for(i = 0; i < n; i++){
+            if(buf[i] != 's'){
+                printf(1, "splice pipe to file: reader got wrong data\n");
+                exit();
+            }
+        }
+        total += n;
+    }
+    close(fds[0]);
+    wait();
+    wait();
+    
+    fd = open("spliceout", 0);
+    if(fd < 0 || fstat(fd, &st) < 0){
+        printf(1, "open spliceout failed\n");
+        exit();
+    }
+    while((n = read(fd, buf, sizeof(buf))) > 0){
+        for(i = 0; i < n; i++){
+            if(buf[i] != 's'){
+                printf(1, "splice pipe to file: file has wrong data\n");
+                exit();
+            }
+        }
+    }
+    close(fd);
+    if(total + st.size != 4 * sizeof(buf)){
+        printf(1, "splice pipe to file: %d + %d bytes\n", total, st.size);
+        exit();
+    }
+    
+    unlink("splicein");
+    unlink("spliceout");
+    printf(1, "splice ok\n");
+}
+
+// a shared writable mapping: seen across fork, written back at
+// exit and at munmap, and coherent with write().
+void
+mmaptest(void)
+{
+    int fd, fd2, pid, i;
+    char *p;
+    
+    printf(1, "mmap test\n");
+    unlink("mmapf");
+    fd = open("mmapf", O_CREATE|O_RDWR);
+    if(fd < 0){
+        printf(1, "create mmapf failed\n");
+        exit();
+    }
+    memset(buf, 'a', sizeof(buf));
+    if(write(fd, buf, 8192) != 8192){
+        printf(1, "write mmapf failed\n");
+        exit();
+    }
+    
+    p = mmap(fd, 0, 8192, MAP_WRITE|MAP_SHARED);
+    if(p == 0){
+        printf(1, "mmap failed\n");
+        exit();
+    }
+    
+    pid = fork();
+    if(pid < 0){
+        printf(1, "fork failed\n");
+        exit();
+    }
+    if(pid == 0){
+        p[0] = 'b';
+        p[5000] = 'c';
+        exit();
+    }
+    wait();
+    if(p[0] != 'b' || p[5000] != 'c'){
+        printf(1, "mmap: child's writes not seen\n");
+        exit();
+    }
+    fd2 = open("mmapf", 0);
+    if(read(fd2, buf, 8192) != 8192 || buf[0] != 'b' || buf[5000] != 'c'){
+        printf(1, "mmap: not written back at exit\n");
+        exit();
+    }
+    close(fd2);
+    
+    p[100] = 'd';
+    if(munmap(p, 8192) != 0){
+        printf(1, "munmap failed\n");
+        exit();
+    }
+    fd2 = open("mmapf", 0);
+    if(read(fd2, buf, 8192) != 8192 || buf[100] != 'd'){
+        printf(1, "mmap: not written back at munmap\n");
+        exit();
+    }
+    close(fd2);
+    
+    // write() changes what is mapped, and a later write-back of
+    // the mapping keeps the change
+    p = mmap(fd, 0, 8192, MAP_WRITE|MAP_SHARED);
+    if(p == 0){
+        printf(1, "mmap again failed\n");
+        exit();
+    }
+    p[4096] = 'f';
+    fd2 = open("mmapf", O_RDWR);
+    memset(buf, 'e', 300);
+    if(write(fd2, buf, 300) != 300){
+        printf(1, "write mapped mmapf failed\n");
+        exit();
+    }
+    close(fd2);
+    if(p[0] != 'e' || p[299] != 'e' || p[300] != 'a'){
+        printf(1, "mmap: write() not seen in the mapping\n");
+        exit();
+    }
+    p[400] = 'g';
+    if(munmap(p, 8192) != 0){
+        printf(1, "munmap failed\n");
+        exit();
+    }
+    fd2 = open("mmapf", 0);
+    if(read(fd2, buf, 8192) != 8192){
+        printf(1, "read mmapf failed\n");
+        exit();
+    }
+    for(i = 0; i < 300; i++){
+        if(buf[i] != 'e'){
+            printf(1, "mmap: write-back lost a write()\n");
+            exit();
+        }
+    }
+    if(buf[400] != 'g' || buf[4096] != 'f' || buf[5000] != 'c'){
+        printf(1, "mmap: write-back lost a store\n");
+        exit();
+    }
+    close(fd2);
+    close(fd);
+    unlink("mmapf");
+    printf(1, "mmap ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1186,6 +1439,56 @@ rmdot(void)
     printf(1, "rmdot ok\n");
 }
 
+// a removed directory's inode is reused at once for the next one;
+// nothing of the old directory's contents may show through.
+void
+remkdir(void)
+{
+    int i, fd;
+    
+    printf(1, "remkdir test\n");
+    
+    for(i = 0; i < 4; i++){
+        if(mkdir("rdir") != 0){
+            printf(1, "mkdir rdir failed\n");
+            exit();
+        }
+        fd = open("rdir/old", O_CREATE|O_RDWR);
+        if(fd < 0){
+            printf(1, "create rdir/old failed\n");
+            exit();
+        }
+        close(fd);
+        if(unlink("rdir/old") != 0 || unlink("rdir") != 0){
+            printf(1, "unlink rdir failed\n");
+            exit();
+        }
+        if(mkdir("rdir2") != 0){
+            printf(1, "mkdir rdir2 after unlink rdir failed\n");
+            exit();
+        }
+        if(open("rdir2/old", 0) >= 0){
+            printf(1, "rdir2/old exists\n");
+            exit();
+        }
+        if(chdir("rdir2/..") != 0){
+            printf(1, "chdir rdir2/.. failed\n");
+            exit();
+        }
+        fd = open("rdir2/old", O_CREATE|O_RDWR);
+        if(fd < 0){
+            printf(1, "create rdir2/old failed\n");
+            exit();
+        }
+        close(fd);
+        if(unlink("rdir2/old") != 0 || unlink("rdir2") != 0){
+            printf(1, "unlink rdir2 failed\n");
+            exit();
+        }
+    }
+    printf(1, "remkdir ok\n");
+}
+
 void
 dirfile(void)
 {
@@ -1625,11 +1928,14 @@ main(int argc, char *argv[])
     createtest();
     
     mem();
+    mmaptest();
     pipe1();
+    splicetest();
     //preempt();
     exitwait();
     
     rmdot();
+    remkdir();
     fourteen();
     bigfile();
     subdir();
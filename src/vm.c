@@ -6,6 +6,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
@@ -26,9 +29,28 @@ struct {
     struct run *freelist;
 } kpt_mem;
 
+// Reference counts of the physical pages mapped into user space.
+// After fork, parent and child share their pages copy-on-write
+// until one of them writes; a page is freed with its last mapping.
+static struct {
+    struct spinlock lock;
+    ushort ref[PHYSTOP >> PTE_SHIFT];
+} pgref;
+
+// statistics of the demand-paged user memory
+static struct {
+    uint reserved;      // pages reserved by growing processes
+    uint faulted;       // pages allocated on first touch
+    uint cow;           // pages copied on write
+    uint filein;        // private pages read from a program file
+    uint shared;        // pages mapped from the page cache
+    uint written;       // pages of shared mappings written back
+} vmstats;
+
 void init_vmm (void)
 {
     initlock(&kpt_mem.lock, "vm");
+    initlock(&pgref.lock, "pgref");
     kpt_mem.freelist = NULL;
 }
 
@@ -84,6 +106,60 @@ void* kpt_alloc (void)
     return (char*) r;
 }
 
+// Allocate a page for user space, with one reference.
+char* alloc_upage (void)
+{
+    char *mem;
+
+    if ((mem = alloc_page()) != 0) {
+        acquire(&pgref.lock);
+        pgref.ref[v2p(mem) >> PTE_SHIFT] = 1;
+        release(&pgref.lock);
+    }
+
+    return mem;
+}
+
+// Add a reference to the user page at physical address pa.
+void dup_upage (uint pa)
+{
+    acquire(&pgref.lock);
+    pgref.ref[pa >> PTE_SHIFT]++;
+    release(&pgref.lock);
+}
+
+// Drop a reference to the user page at physical address pa,
+// freeing it if that was the last one.
+void free_upage (uint pa)
+{
+    int ref;
+
+    acquire(&pgref.lock);
+
+    if (pgref.ref[pa >> PTE_SHIFT] == 0) {
+        panic("free_upage");
+    }
+
+    ref = --pgref.ref[pa >> PTE_SHIFT];
+    release(&pgref.lock);
+
+    if (ref == 0) {
+        free_page(p2v(pa));
+    }
+}
+
+// Return the number of references to the user page at pa.
+int upage_ref (uint pa)
+{
+    int ref;
+
+    acquire(&pgref.lock);
+    ref = pgref.ref[pa >> PTE_SHIFT];
+    release(&pgref.lock);
+
+    return ref;
+}
+
 // Return the address of the PTE in page directory that corresponds to
 // virtual address va.  If alloc!=0, create any required page table pages.
 static pte_t* walkpgdir (pde_t *pgdir, const void *va, int alloc)
@@ -186,42 +262,11 @@ void inituvm (pde_t *pgdir, char *init, uint sz)
         panic("inituvm: more than a page");
     }
 
-    mem = alloc_page();
+    mem = alloc_upage();
     memset(mem, 0, PTE_SZ);
-    mappages(pgdir, 0, PTE_SZ, v2p(mem), AP_KU);
     memmove(mem, init, sz);
-}
-
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int loaduvm (pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-    uint i, pa, n;
-    pte_t *pte;
-
-    if ((uint) addr % PTE_SZ != 0) {
-        panic("loaduvm: addr must be page aligned");
-    }
-
-    for (i = 0; i < sz; i += PTE_SZ) {
-        if ((pte = walkpgdir(pgdir, addr + i, 0)) == 0) {
-            panic("loaduvm: address should exist");
-        }
-
-        pa = PTE_ADDR(*pte);
-
-        if (sz - i < PTE_SZ) {
-            n = sz - i;
-        } else {
-            n = PTE_SZ;
-        }
-
-        if (readi(ip, p2v(pa), offset + i, n) != n) {
-            return -1;
-        }
-    }
-
-    return 0;
+    sync_icache(mem, sz);
+    mappages(pgdir, 0, PTE_SZ, v2p(mem), AP_KU);
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
@@ -242,7 +287,7 @@ int allocuvm (pde_t *pgdir, uint oldsz, uint newsz)
     a = align_up(oldsz, PTE_SZ);
 
     for (; a < newsz; a += PTE_SZ) {
-        mem = alloc_page();
+        mem = alloc_upage();
 
         if (mem == 0) {
             cprintf("allocuvm out of memory\n");
@@ -257,6 +302,33 @@ int allocuvm (pde_t *pgdir, uint oldsz, uint newsz)
     return newsz;
 }
 
+// Reserve address space to grow process from oldsz to newsz, which
+// need not be page aligned. No memory is allocated: uvm_fault maps
+// a zeroed page when one is first touched. We refuse to reserve more
+// pages than are free now, so that processes fail to grow rather than
+// run out of memory later. Returns new size or 0 on error.
+int reserveuvm (pde_t *pgdir, uint oldsz, uint newsz)
+{
+    uint npages;
+
+    if (newsz >= UADDR_SZ) {
+        return 0;
+    }
+
+    if (newsz < oldsz) {
+        return oldsz;
+    }
+
+    npages = (align_up(newsz, PTE_SZ) - align_up(oldsz, PTE_SZ)) >> PTE_SHIFT;
+
+    if (npages > free_pages()) {
+        return 0;
+    }
+
+    vmstats.reserved += npages;
+    return newsz;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -276,8 +348,8 @@ int deallocuvm (pde_t *pgdir, uint oldsz, uint newsz)
 
         if (!pte) {
             // pte == 0 --> no page table for this entry
-            // round it up to the next page directory
-            a = align_up (a, PDE_SZ);
+            // skip to the last page of this page directory entry
+            a = align_up (a + 1, PDE_SZ) - PTE_SZ;
 
         } else if ((*pte & PE_TYPES) != 0) {
             pa = PTE_ADDR(*pte);
@@ -286,7 +358,7 @@ int deallocuvm (pde_t *pgdir, uint oldsz, uint newsz)
                 panic("deallocuvm");
             }
 
-            free_page(p2v(pa));
+            free_upage(pa);
             *pte = 0;
         }
     }
@@ -334,14 +406,50 @@ void clearpteu (pde_t *pgdir, char *uva)
     *pte = (*pte & ~(0x03 << 4)) | AP_KO << 4;
 }
 
+// Copy the mappings of [start, end) of pgdir to d, sharing the pages.
+// Writable pages are made copy-on-write unless share is set.
+static int copyrange (pde_t *d, pde_t *pgdir, uint start, uint end, int share)
+{
+    pte_t *pte, *npte;
+    uint pa, i;
+
+    for (i = start; i < end; i += PTE_SZ) {
+        // pages that have not been touched yet stay reserved
+        if ((pte = walkpgdir(pgdir, (void *) i, 0)) == 0) {
+            i = align_up (i + 1, PDE_SZ) - PTE_SZ;
+            continue;
+        }
+
+        if (!(*pte & PE_TYPES)) {
+            continue;
+        }
+
+        pa = PTE_ADDR (*pte);
+
+        if ((npte = walkpgdir(d, (void *) i, 1)) == 0) {
+            return -1;
+        }
+
+        if (!share && (PTE_AP(*pte) == AP_KU) && !(*pte & PTE_APX)) {
+            *pte = (*pte & ~(0x03 << 4)) | (AP_KUR << 4) | PTE_APX | PTE_COW;
+        }
+
+        *npte = *pte;
+        dup_upage(pa);
+    }
+
+    return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
-pde_t* copyuvm (pde_t *pgdir, uint sz)
+// of it for a child. The pages are not copied but shared:
+// writable pages are made read-only and copy-on-write in
+// both page tables, and copied by the first write fault.
+// The pages of the shared mappings in v stay shared.
+pde_t* copyuvm (pde_t *pgdir, uint sz, struct vma *v)
 {
     pde_t *d;
-    pte_t *pte;
-    uint pa, i, ap;
-    char *mem;
+    int i;
 
     // allocate a new first level page directory
     d = kpt_alloc();
@@ -349,35 +457,482 @@ pde_t* copyuvm (pde_t *pgdir, uint sz)
         return NULL ;
     }
 
-    // copy the whole address space over (no COW)
-    for (i = 0; i < sz; i += PTE_SZ) {
-        if ((pte = walkpgdir(pgdir, (void *) i, 0)) == 0) {
-            panic("copyuvm: pte should exist");
+    if (copyrange(d, pgdir, 0, sz, 0) < 0) {
+        goto bad;
+    }
+
+    for (i = 0; i < NVMA; i++) {
+        if ((v[i].ip != 0) && (v[i].flags & VMA_MMAP) && (copyrange(d, pgdir,
+                v[i].vaddr, v[i].vaddr + v[i].memsz, v[i].flags & VMA_SHARED) < 0)) {
+            goto bad;
         }
+    }
 
-        if (!(*pte & PE_TYPES)) {
-            panic("copyuvm: page not present");
+    // the parent's writable pages have just become read-only
+    flush_tlb();
+    return d;
+
+bad: freevm(d);
+    flush_tlb();
+    return 0;
+}
+
+// Give the process its own writable copy of the copy-on-write page
+// mapped by pte. If no one else shares the page any more, it simply
+// becomes writable again. Return 0 on success, -1 if out of memory.
+static int cow_break (pte_t *pte)
+{
+    uint pa;
+    char *mem;
+
+    pa = PTE_ADDR(*pte);
+
+    acquire(&pgref.lock);
+
+    if (pgref.ref[pa >> PTE_SHIFT] == 1) {
+        release(&pgref.lock);
+
+    } else {
+        release(&pgref.lock);
+
+        if ((mem = alloc_upage()) == 0) {
+            return -1;
         }
 
-        pa = PTE_ADDR (*pte);
-        ap = PTE_AP (*pte);
+        memmove(mem, p2v(pa), PTE_SZ);
+        free_upage(pa);
+        pa = v2p(mem);
+        vmstats.cow++;
+    }
 
-        if ((mem = alloc_page()) == 0) {
-            goto bad;
+    *pte = pa | (*pte & ~(PTE_ADDR(~0) | (0x03 << 4) | PTE_APX | PTE_COW)) | (AP_KU << 4);
+    flush_tlb();
+
+    return 0;
+}
+
+// Map a zeroed page at va, the first touch of a reserved page.
+static int fault_zero (pde_t *pgdir, uint va)
+{
+    char *mem;
+
+    if ((mem = alloc_upage()) == 0) {
+        cprintf("fault_zero: out of memory\n");
+        return -1;
+    }
+
+    memset(mem, 0, PTE_SZ);
+
+    if (mappages(pgdir, (char*) align_dn(va, PTE_SZ), PTE_SZ, v2p(mem), AP_KU) < 0) {
+        free_upage(v2p(mem));
+        return -1;
+    }
+
+    vmstats.faulted++;
+    return 0;
+}
+
+// Fill mem, the page at user address va, with the contents of
+// the file-backed regions of p that overlap it.
+static int fill_page (struct proc *p, char *mem, uint va)
+{
+    struct vma *v;
+    uint s, e;
+    int n;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if (v->ip == 0) {
+            continue;
         }
 
-        memmove(mem, (char*) p2v(pa), PTE_SZ);
+        s = UMAX(va, v->vaddr);
+        e = UMIN(va + PTE_SZ, v->vaddr + v->filesz);
 
-        if (mappages(d, (void*) i, PTE_SZ, v2p(mem), ap) < 0) {
-            goto bad;
+        if (s >= e) {
+            continue;
+        }
+
+        ilock(v->ip);
+        n = readi(v->ip, mem + (s - va), v->off + (s - v->vaddr), e - s);
+        iunlock(v->ip);
+
+        if (n != e - s) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Return the mmap region of p that va is in, or 0.
+static struct vma* findmmap (struct proc *p, uint va)
+{
+    struct vma *v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if ((v->ip != 0) && (v->flags & VMA_MMAP)
+                && (va >= v->vaddr) && (va < v->vaddr + v->memsz)) {
+            return v;
+        }
+    }
+
+    return 0;
+}
+
+// Return the end of the valid user memory of p that va is in:
+// the process image below sz, or a mapped file. Return 0 if
+// va is not valid.
+uint uvm_limit (struct proc *p, uint va)
+{
+    struct vma *v;
+
+    if (va < p->sz) {
+        return p->sz;
+    }
+
+    if ((v = findmmap(p, va)) != 0) {
+        return v->vaddr + v->memsz;
+    }
+
+    return 0;
+}
+
+// Map the page at va of process p on its first touch. Pages of
+// the file-backed regions are read from the file; others, such as
+// the heap reserved by growproc, are zero. This may sleep.
+static int fault_in (struct proc *p, uint va)
+{
+    struct vma *v, *text;
+    char *mem;
+    uint pa;
+    int ap, n;
+
+    va = align_dn(va, PTE_SZ);
+    text = 0;
+    ap = AP_KUR;
+
+    for (n = 0, v = p->vma; v < &p->vma[NVMA]; v++) {
+        if ((v->ip != 0) && (va < v->vaddr + v->memsz) && (v->vaddr < va + PTE_SZ)) {
+            if (v->flags & VMA_WRITE) {
+                ap = AP_KU;
+            }
+
+            text = v;
+            n++;
+        }
+    }
+
+    if (n == 0) {
+        return fault_zero(p->pgdir, va);
+    }
+
+    // A whole page of read-only file contents that is page-aligned
+    // in the file is shared with other processes through the page
+    // cache, and so is every page of a shared mapping. The latter is
+    // mapped read-only at first, and made writable by the first write
+    // (see uvm_fault), which marks it dirty. Anything else gets a
+    // private copy.
+    if ((n == 1) && (text->flags & VMA_SHARED)) {
+        ap = AP_KUR;
+    }
+
+    if ((n == 1) && (ap == AP_KUR) && ((text->off - text->vaddr) % PTE_SZ == 0)
+            && (va >= text->vaddr) && ((va + PTE_SZ <= text->vaddr + text->filesz)
+            || (text->flags & VMA_SHARED))) {
+        ilock(text->ip);
+        pa = pcache_get(text->ip, (text->off + (va - text->vaddr)) >> PTE_SHIFT,
+                        text->flags & VMA_SHARED);
+        iunlock(text->ip);
+
+        if (pa == 0) {
+            return -1;
+        }
+
+        vmstats.shared++;
+
+    } else {
+        if ((mem = alloc_upage()) == 0) {
+            cprintf("fault_in: out of memory\n");
+            return -1;
+        }
+
+        memset(mem, 0, PTE_SZ);
+
+        if (fill_page(p, mem, va) < 0) {
+            free_upage(v2p(mem));
+            return -1;
+        }
+
+        sync_icache(mem, PTE_SZ);
+
+        pa = v2p(mem);
+        vmstats.filein++;
+    }
+
+    if (mappages(p->pgdir, (char*) va, PTE_SZ, pa, ap) < 0) {
+        free_upage(pa);
+        return -1;
+    }
+
+    // read-only for the kernel too, the page may be shared
+    if (ap == AP_KUR) {
+        *walkpgdir(p->pgdir, (char*) va, 0) |= PTE_APX;
+    }
+
+    return 0;
+}
+
+// Resolve a data abort at virtual address va of process p, with
+// fault status dfs. Return 0 if the faulting access can be retried.
+int uvm_fault (struct proc *p, uint va, uint dfs)
+{
+    struct vma *v;
+    pte_t *pte;
+    uint status;
+
+    if (uvm_limit(p, va) == 0) {
+        return -1;
+    }
+
+    pte = walkpgdir(p->pgdir, (void*) va, 0);
+    status = DFS_STATUS(dfs);
+
+    // first touch of a page of the program or of the heap
+    if ((status == FS_TRANS_SEC) || (status == FS_TRANS_PG)) {
+        return fault_in(p, va);
+    }
+
+    // a write to a copy-on-write page
+    if ((status == FS_PERM_PG) && (dfs & DFS_WRITE)
+            && (pte != 0) && (*pte & PTE_COW)) {
+        return cow_break(pte);
+    }
+
+    // the first write to a page of a shared writable mapping: make
+    // it writable, which also records that it is dirty
+    if ((status == FS_PERM_PG) && (dfs & DFS_WRITE) && (pte != 0)
+            && ((v = findmmap(p, va)) != 0)
+            && ((v->flags & (VMA_SHARED | VMA_WRITE)) == (VMA_SHARED | VMA_WRITE))) {
+        *pte = (*pte & ~((0x03 << 4) | PTE_APX)) | (AP_KU << 4);
+        flush_tlb();
+        return 0;
+    }
+
+    return -1;
+}
+
+// Make sure that the user memory [va, va+n) of process p is
+// backed by pages, mapping the ones that have not been touched
+// yet. Return -1 if we run out of memory or cannot read them.
+int uvm_prefault (struct proc *p, uint va, uint n)
+{
+    pte_t *pte;
+    uint a;
+
+    for (a = align_dn(va, PTE_SZ); a < va + n; a += PTE_SZ) {
+        pte = walkpgdir(p->pgdir, (void*) a, 0);
+
+        if (((pte == 0) || !(*pte & PE_TYPES)) && (fault_in(p, a) < 0)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Copy the file-backed regions v of a parent to nv of its child.
+void dupvmas (struct vma *nv, struct vma *v)
+{
+    int i;
+
+    for (i = 0; i < NVMA; i++) {
+        nv[i] = v[i];
+
+        if (v[i].ip != 0) {
+            idup(v[i].ip);
+        }
+    }
+}
+
+// Release the files of the regions in v. Since it may put the last
+// reference to an unlinked file, it must be called in a transaction.
+void freevmas (struct vma *v)
+{
+    int i;
+
+    for (i = 0; i < NVMA; i++) {
+        if (v[i].ip != 0) {
+            iput(v[i].ip);
+            v[i].ip = 0;
+        }
+    }
+}
+
+// Write the dirty pages of the shared writable mapping v back to
+// its file, each in a transaction of its own, and make them clean.
+// Bytes past the end of the file are dropped. This may sleep.
+static void vma_writeback (pde_t *pgdir, struct vma *v)
+{
+    pte_t *pte;
+    uint a, off;
+
+    if ((v->flags & (VMA_SHARED | VMA_WRITE)) != (VMA_SHARED | VMA_WRITE)) {
+        return;
+    }
+
+    for (a = v->vaddr; a < v->vaddr + v->memsz; a += PTE_SZ) {
+        pte = walkpgdir(pgdir, (void*) a, 0);
+
+        if ((pte == 0) || !(*pte & PE_TYPES) || (PTE_AP(*pte) != AP_KU)) {
+            continue;
+        }
+
+        off = v->off + (a - v->vaddr);
+
+        begin_trans();
+        ilock(v->ip);
+
+        if (off < v->ip->size) {
+            writei(v->ip, p2v(PTE_ADDR(*pte)), off, UMIN(PTE_SZ, v->ip->size - off));
+            vmstats.written++;
+        }
+
+        iunlock(v->ip);
+        commit_trans();
+
+        *pte = (*pte & ~(0x03 << 4)) | (AP_KUR << 4) | PTE_APX;
+    }
+
+    flush_tlb();
+}
+
+// Map len bytes of file ip at offset off (page-aligned) into p,
+// with MAP_ flags. The mapping goes below the other mappings, at
+// the highest address that leaves the heap room. Return its
+// address, or 0 if there is no room.
+uint uvm_mmap (struct proc *p, struct inode *ip, uint off, uint len, int flags)
+{
+    struct vma *v, *nv;
+    uint top, start, best;
+    int i;
+
+    len = align_up(len, PTE_SZ);
+    nv = 0;
+    best = 0;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if ((v->ip == 0) && (nv == 0)) {
+            nv = v;
+        }
+    }
+
+    if ((nv == 0) || (len == 0) || (len > UADDR_SZ)) {
+        return 0;
+    }
+
+    // try the gap below the top and below every other mapping
+    for (i = -1; i < NVMA; i++) {
+        if (i < 0) {
+            top = UADDR_SZ;
+        } else if ((p->vma[i].ip != 0) && (p->vma[i].flags & VMA_MMAP)) {
+            top = p->vma[i].vaddr;
+        } else {
+            continue;
+        }
+
+        if ((top < len) || ((start = top - len) < align_up(p->sz, PTE_SZ))
+                || (start <= best) || uvm_mapped(p, start, top)) {
+            continue;
+        }
+
+        best = start;
+    }
+
+    if (best == 0) {
+        return 0;
+    }
+
+    ilock(ip);
+    nv->filesz = (off < ip->size) ? UMIN(len, ip->size - off) : 0;
+    iunlock(ip);
+
+    nv->ip = idup(ip);
+    nv->vaddr = best;
+    nv->memsz = len;
+    nv->off = off;
+    nv->flags = VMA_MMAP;
+
+    if (flags & MAP_WRITE) {
+        nv->flags |= VMA_WRITE;
+    }
+
+    if (flags & MAP_SHARED) {
+        nv->flags |= VMA_SHARED;
+    }
+
+    return best;
+}
+
+// Return whether any mapped file of p overlaps [start, end).
+int uvm_mapped (struct proc *p, uint start, uint end)
+{
+    struct vma *v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if ((v->ip != 0) && (v->flags & VMA_MMAP)
+                && (start < v->vaddr + v->memsz) && (v->vaddr < end)) {
+            return 1;
         }
     }
-    return d;
 
-bad: freevm(d);
     return 0;
 }
 
+// Remove the mapping at va of p, which is len bytes long, writing
+// its dirty pages back first. Return -1 if there is no such mapping.
+int uvm_munmap (struct proc *p, uint va, uint len)
+{
+    struct vma *v;
+
+    if (((v = findmmap(p, va)) == 0) || (v->vaddr != va)
+            || (v->memsz != align_up(len, PTE_SZ))) {
+        return -1;
+    }
+
+    vma_writeback(p->pgdir, v);
+    deallocuvm(p->pgdir, v->vaddr + v->memsz, v->vaddr);
+    flush_tlb();
+
+    begin_trans();
+    iput(v->ip);
+    commit_trans();
+    v->ip = 0;
+
+    return 0;
+}
+
+// Write back the dirty pages of all the shared mappings of p, as
+// it exits or execs. The mappings are removed later, by freevmas.
+void syncvmas (struct proc *p)
+{
+    struct vma *v;
+
+    for (v = p->vma; v < &p->vma[NVMA]; v++) {
+        if ((v->ip != 0) && (v->flags & VMA_MMAP)) {
+            vma_writeback(p->pgdir, v);
+        }
+    }
+}
+
+// Print statistics of the user memory to the console.
+void vmstat (void)
+{
+    cprintf("vm: %d pages reserved, %d faulted in, %d copied on write\n",
+            vmstats.reserved, vmstats.faulted, vmstats.cow);
+    cprintf("vm: %d file pages read, %d mapped from the page cache, %d written back\n",
+            vmstats.filein, vmstats.shared, vmstats.written);
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char* uva2ka (pde_t *pgdir, char *uva)
@@ -406,11 +961,20 @@ int copyout (pde_t *pgdir, uint va, void *p, uint len)
 {
     char *buf, *pa0;
     uint n, va0;
+    pte_t *pte;
 
     buf = (char*) p;
 
     while (len > 0) {
         va0 = align_dn(va, PTE_SZ);
+
+        // copying into a page shared copy-on-write
+        pte = walkpgdir(pgdir, (char*) va0, 0);
+
+        if ((pte != 0) && (*pte & PTE_COW) && (cow_break(pte) < 0)) {
+            return -1;
+        }
+
         pa0 = uva2ka(pgdir, (char*) va0);
 
         if (pa0 == 0) {